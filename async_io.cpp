@@ -0,0 +1,166 @@
+#include "async_io.h"
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <algorithm>
+#include <cstdio>
+
+
+std::vector<std::string> read_source_lines(const std::string& file_name)
+{
+    std::ifstream filehandle(file_name);
+    if (!filehandle.is_open())
+    {
+        throw std::runtime_error("Failed to open file: " + file_name);
+    }
+    std::vector<std::string> lines;
+    std::string l;
+    while(std::getline(filehandle, l))
+    {
+        lines.push_back(l);
+    }
+    return lines;
+}
+
+std::vector<std::string> split_source_lines(std::string_view text)
+{
+    std::vector<std::string> lines;
+    size_t start = 0;
+    while(start < text.size())
+    {
+        size_t end = text.find('\n', start);
+        if(end == std::string::npos)
+        {
+            end = text.size();
+        }
+        lines.emplace_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+bool write_file_atomically(const std::string& file_name, const std::string& content)
+{
+    std::string tmp = file_name + ".tmp";
+    std::ofstream out(tmp);
+    out << content;
+    out.close();
+    if(!out || std::rename(tmp.c_str(), file_name.c_str()) != 0)
+    {
+        std::remove(tmp.c_str());
+        std::cerr << "Can't write " << file_name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//=======================================================================================================================================================================
+source_prefetcher::source_prefetcher(std::vector<std::string> file_names, size_t ahead) : names{file_names}, window{ahead < 1 ? 1 : ahead}
+{
+    for(; next_started < names.size() && next_started < window; next_started++)
+    {
+        reading.push_back(std::async(std::launch::async, read_source_lines, names[next_started]));
+    }
+}
+
+std::vector<std::string> source_prefetcher::take()
+{
+    std::vector<std::string> lines = reading.front().get();
+    reading.pop_front();
+    if(next_started < names.size())
+    {
+        reading.push_back(std::async(std::launch::async, read_source_lines, names[next_started]));
+        next_started++;
+    }
+    return lines;
+}
+
+//=======================================================================================================================================================================
+static std::vector<output_writer*> live_writers; //written before exit() ends the program
+static std::mutex live_writers_m;
+
+static void finish_live_writers()
+{
+    std::vector<output_writer*> writers;
+    {
+        std::lock_guard<std::mutex> lock(live_writers_m);
+        writers = live_writers;
+    }
+    for(output_writer* w : writers)
+    {
+        w->finish();
+    }
+}
+
+output_writer::output_writer(size_t max_bytes) : max_queued_bytes{max_bytes}
+{
+    static bool registered = (std::atexit(finish_live_writers), true);
+    (void)registered;
+    {
+        std::lock_guard<std::mutex> lock(live_writers_m);
+        live_writers.push_back(this);
+    }
+    worker = std::thread(&output_writer::run, this);
+}
+
+output_writer::~output_writer()
+{
+    finish();
+    std::lock_guard<std::mutex> lock(live_writers_m);
+    live_writers.erase(std::find(live_writers.begin(), live_writers.end(), this));
+}
+
+void output_writer::run()
+{
+    std::unique_lock<std::mutex> lock(m);
+    while(true)
+    {
+        changed.wait(lock, [this]{ return done || !queue.empty(); });
+        if(queue.empty())
+        {
+            return;
+        }
+        pending_file& f = queue.front();
+        lock.unlock();
+        std::ofstream out(f.name);
+        out << f.content;
+        out.close();
+        if(!out)
+        {
+            std::cerr << "Can't write " << f.name << std::endl;
+        }
+        lock.lock();
+        queued_bytes -= f.content.size();
+        queue.pop_front();
+        changed.notify_all();
+    }
+}
+
+void output_writer::write(std::string name, std::string content)
+{
+    std::unique_lock<std::mutex> lock(m);
+    changed.wait(lock, [this, &content]{ return queue.empty() || queued_bytes + content.size() <= max_queued_bytes; });
+    queued_bytes += content.size();
+    queue.push_back(pending_file{std::move(name), std::move(content)});
+    changed.notify_all();
+}
+
+void output_writer::flush()
+{
+    std::unique_lock<std::mutex> lock(m);
+    changed.wait(lock, [this]{ return queue.empty(); });
+}
+
+void output_writer::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        done = true;
+    }
+    changed.notify_all();
+    if(worker.joinable() && worker.get_id() != std::this_thread::get_id())
+    {
+        worker.join();
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+//reading sources ahead of the compiler and writing its output behind it, both on plain threads
+
+std::vector<std::string> read_source_lines(const std::string& file_name); //throws std::runtime_error when the file can't be opened
+std::vector<std::string> split_source_lines(std::string_view text); //the lines read_source_lines gives for a file holding text
+bool write_file_atomically(const std::string& file_name, const std::string& content); //through a .tmp file renamed over it, readers never see half a file
+
+class source_prefetcher //keeps the next few sources being read while the current one compiles
+{
+    std::vector<std::string> names;
+    std::deque<std::future<std::vector<std::string>>> reading; //reads started and not taken yet, oldest first
+    size_t next_started = 0;
+    size_t window;
+public:
+    source_prefetcher(std::vector<std::string> file_names, size_t ahead);
+    std::vector<std::string> take(); //lines of the next file in order, waits for its read
+};
+
+//files are written by one background thread in the order they were queued. write() waits while more than
+//max_queued_bytes are not written yet, so memory stays bounded when the disk is slower than the compiler.
+//the queue is also emptied when the program exits from an error, so earlier files still reach the disk
+class output_writer
+{
+    struct pending_file
+    {
+        std::string name;
+        std::string content;
+    };
+    std::deque<pending_file> queue;
+    size_t queued_bytes = 0;
+    size_t max_queued_bytes;
+    bool done = false;
+    std::mutex m;
+    std::condition_variable changed;
+    std::thread worker;
+
+    void run();
+public:
+    explicit output_writer(size_t max_bytes = 64 << 20);
+    ~output_writer();
+    output_writer(const output_writer&) = delete;
+    output_writer& operator=(const output_writer&) = delete;
+
+    void write(std::string name, std::string content);
+    void flush(); //waits until everything queued so far is on disk
+    void finish(); //flushes and stops the thread
+};
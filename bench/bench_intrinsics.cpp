@@ -0,0 +1,120 @@
+#include "jackc.h"
+#include "vm_interpreter.h"
+#include <iostream>
+#include <sstream>
+
+/*
+VM steps of a loop over Memory.peek/poke and Math.abs/min/max, compiled as calls and with --inline-intrinsics.
+The calls go to the small Memory and Math classes below, written the way the os writes them, so a call costs
+what it costs against the real os rather than the one step of the interpreter's built in versions.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -pthread -I. bench/bench_intrinsics.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o bench_intrinsics
+    ./bench_intrinsics
+*/
+
+static const char* main_class = R"(
+class Main {
+    function void main() {
+        var int i, a, s;
+        do Memory.init();
+        let i = 0;
+        let s = 0;
+        while (i < 2000) {
+            do Memory.poke(8000 + (i & 255), i);
+            let a = Memory.peek(8000 + (i & 255));
+            let s = s + Math.abs(a - 1000) + Math.min(a, 500) + Math.max(a, 1500);
+            let i = i + 1;
+        }
+        do Output.printInt(s);
+        return;
+    }
+}
+)";
+
+static const char* memory_class = R"(
+class Memory {
+    static Array ram;
+    function void init() {
+        let ram = 0;
+        return;
+    }
+    function int peek(int address) {
+        return ram[address];
+    }
+    function void poke(int address, int value) {
+        let ram[address] = value;
+        return;
+    }
+}
+)";
+
+static const char* math_class = R"(
+class Math {
+    function int abs(int x) {
+        if (x < 0) {
+            return -x;
+        }
+        return x;
+    }
+    function int min(int a, int b) {
+        if (a < b) {
+            return a;
+        }
+        return b;
+    }
+    function int max(int a, int b) {
+        if (a > b) {
+            return a;
+        }
+        return b;
+    }
+}
+)";
+
+static bool run(const compile_options& options, long long& steps, std::string& printed)
+{
+    std::vector<std::string> names{"Main.jack", "Memory.jack", "Math.jack"};
+    std::vector<std::string> sources{main_class, memory_class, math_class};
+    signature_index signatures;
+    signatures.build_in_memory(names, sources);
+    vm_interpreter vm;
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        jackc::result r = jackc::compile(sources[i], options, &signatures);
+        if(!r.ok)
+        {
+            std::cerr << names[i] << " has syntax errors" << std::endl;
+            return false;
+        }
+        std::istringstream vm_code(r.vm);
+        vm.load(vm_code, names[i]);
+    }
+    std::ostringstream out;
+    vm.print_to(&out);
+    bool finished = vm.run(100000000);
+    steps = vm.return_steps();
+    printed = out.str();
+    return finished;
+}
+
+int main()
+{
+    compile_options calls, inlined;
+    inlined.inline_intrinsics = true;
+    long long call_steps = 0, inline_steps = 0;
+    std::string call_out, inline_out;
+    if(!run(calls, call_steps, call_out) || !run(inlined, inline_steps, inline_out))
+    {
+        return 1;
+    }
+    if(call_out != inline_out)
+    {
+        std::cerr << "The two builds print different results: " << call_out << " and " << inline_out << std::endl;
+        return 1;
+    }
+    std::cout << "os calls:           " << call_steps << " vm steps" << std::endl;
+    std::cout << "inline intrinsics:  " << inline_steps << " vm steps" << std::endl;
+    std::cout << "saved:              " << (call_steps - inline_steps) * 100 / call_steps << "%" << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include "jack_tokenizer.h"
+#include "async_io.h"
+#include <iostream>
+#include <chrono>
+
+/*
+Lexer throughput on generated comment-heavy, identifier-heavy and string-heavy sources. Build it twice, once as it is
+and once with -DJACK_SCALAR_SCAN, which leaves the scanning kernels of char_scan.h as plain loops, and compare.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -pthread -I. bench/bench_lexer.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o bench_lexer
+    g++ -std=c++17 -O2 -pthread -I. -DJACK_SCALAR_SCAN bench/bench_lexer.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o bench_lexer_scalar
+    ./bench_lexer && ./bench_lexer_scalar
+*/
+
+const int subroutines = 4000;
+
+static std::string comment_heavy()
+{
+    std::string text = "class Main {\n";
+    for(int s = 0; s < subroutines; s++)
+    {
+        text += "    /** Returns the sum of the first n elements of the buffer. The buffer is never changed, and n must\n"
+                "     *  not be larger than its length, which is checked by the caller before any element is read here.\n"
+                "     *  The loop below runs in order so the cache stays warm, see the notes at the top of this class.\n"
+                "     */\n"
+                "    function int sum" + std::to_string(s) + "(Array buffer, int n) {\n"
+                "        var int i, total; // running index and the sum of the elements before it, both start at zero\n"
+                "        let total = 0; /* the empty sum */\n"
+                "        return total;\n"
+                "    }\n";
+    }
+    return text + "}\n";
+}
+
+static std::string identifier_heavy()
+{
+    std::string text = "class Main {\n";
+    for(int s = 0; s < subroutines; s++)
+    {
+        text += "    function int accumulate_remaining_balance_" + std::to_string(s) + "(int starting_balance_in_cents, int monthly_interest_rate) {\n"
+                "        var int remaining_balance_in_cents, accumulated_interest_in_cents, number_of_elapsed_months;\n"
+                "        let remaining_balance_in_cents = starting_balance_in_cents + accumulated_interest_in_cents;\n"
+                "        let accumulated_interest_in_cents = remaining_balance_in_cents * monthly_interest_rate;\n"
+                "        let number_of_elapsed_months = number_of_elapsed_months + remaining_balance_in_cents;\n"
+                "        return remaining_balance_in_cents;\n"
+                "    }\n";
+    }
+    return text + "}\n";
+}
+
+static std::string string_heavy()
+{
+    std::string text = "class Main {\n";
+    for(int s = 0; s < subroutines; s++)
+    {
+        text += "    function void report" + std::to_string(s) + "() {\n"
+                "        do Output.printString(\"The requested record could not be found in the current table of entries.\");\n"
+                "        do Output.printString(\"Press any key to return to the main menu, or wait for the screen to clear.\");\n"
+                "        return;\n"
+                "    }\n";
+    }
+    return text + "}\n";
+}
+
+static void measure(const std::string& corpus, const std::string& text)
+{
+    std::vector<std::string> lines = split_source_lines(text);
+    double best = 1e30;
+    size_t tokens = 0;
+    for(int run = 0; run < 5; run++)
+    {
+        tokenizer::jack_tokenizer jt;
+        std::string messages;
+        auto started = std::chrono::steady_clock::now();
+        jt.lex_quietly(lines, messages);
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+        for(tokens = 0; jt.peek_token(tokens) != nullptr; tokens++);
+    }
+    std::cout << corpus << text.size() / 1000 << " KB, " << tokens << " tokens, " << text.size() / best / 1e6 << " MB/s" << std::endl;
+}
+
+int main()
+{
+#if defined(__SSE2__) && !defined(JACK_SCALAR_SCAN)
+    std::cout << "sse2 kernels" << std::endl;
+#else
+    std::cout << "scalar kernels" << std::endl;
+#endif
+    measure("comment heavy:     ", comment_heavy());
+    measure("identifier heavy:  ", identifier_heavy());
+    measure("string heavy:      ", string_heavy());
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "jackc.h"
+#include <iostream>
+#include <chrono>
+
+/*
+Compile time of deeply nested parentheses, unary minus chains, ifs and whiles, each at a depth and at twice that
+depth. The parser goes on a fresh stack every parse_stack_levels levels, so doubling the depth should about double
+the time. The parse tree is left out as compiling - leaves it out for vm output: every line of it is indented to
+its level, so its size alone grows with the square of the depth.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -pthread -I. bench/bench_nesting.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o bench_nesting
+    ./bench_nesting
+*/
+
+static std::string nested_source(const std::string& kind, int depth)
+{
+    std::string body;
+    if(kind == "parentheses")
+    {
+        body = "let i = " + std::string(depth, '(') + "i";
+        for(int d = 0; d < depth; d++)
+        {
+            body += " + 1)";
+        }
+        body += ";\n";
+    }
+    else if(kind == "unary minus")
+    {
+        body = "let i = " + std::string(depth, '-') + "i;\n";
+    }
+    else
+    {
+        for(int d = 0; d < depth; d++)
+        {
+            body += kind == "if" ? "if (i < 1) {\n" : "while (i < 1) {\n";
+        }
+        body += "let i = i + 1;\n" + std::string(depth, '}') + "\n";
+    }
+    return "class Main {\n    function void main() {\n        var int i;\n        let i = 0;\n" + body +
+           "        do Output.printInt(i);\n        return;\n    }\n}\n";
+}
+
+static double measure(const std::string& kind, int depth, const compile_options& options, bool& ok)
+{
+    std::string source = nested_source(kind, depth);
+    auto started = std::chrono::steady_clock::now();
+    jackc::result r = jackc::compile(source, options);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    if(!r.ok)
+    {
+        std::cerr << kind << " at depth " << depth << " has syntax errors: " << r.errors.front().what << r.errors.front().line << std::endl;
+        ok = false;
+    }
+    return ms;
+}
+
+int main()
+{
+    compile_options options;
+    options.parse_tree = false;
+    bool ok = true;
+    for(auto [kind, depth] : {std::pair<std::string, int>{"parentheses", 50000}, {"unary minus", 50000}, {"if", 10000}, {"while", 5000}})
+    {
+        double ms = measure(kind, depth, options, ok), twice_ms = measure(kind, 2 * depth, options, ok);
+        std::cout << kind << ": depth " << depth << " " << ms << " ms, depth " << 2 * depth << " " << twice_ms << " ms, ratio " << twice_ms / ms << std::endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+#include "jack_analyzer.h"
+#include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <chrono>
+#include <filesystem>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+Peak memory of compiling one generated class of about 100 MB, once as usual and once with --stream. Without
+--stream the whole source, its tokens and the outputs are held until the class is done. With it the source is
+read as it is lexed and the outputs are written a subroutine at a time, so the source, tokens and outputs take
+the same memory whatever the size of the class. What still grows is the signature index built before compiling,
+about 200 bytes per subroutine declared, so a class of many small subroutines ends up with more than one of few
+large ones. Each compile runs in a process of its own, and its peak resident size is the child's ru_maxrss. The
+class and its outputs go to a directory under the system temp directory, removed at the end.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -pthread -I. bench/bench_stream_memory.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o bench_stream_memory
+    ./bench_stream_memory [megabytes]
+*/
+
+namespace fs = std::filesystem;
+
+static size_t write_class(const fs::path& file, size_t megabytes)
+{
+    std::ofstream out(file, std::ios::binary);
+    size_t bytes = 0;
+    out << "class Main {\n";
+    for(int s = 0; bytes < megabytes << 20; s++)
+    {
+        std::string subroutine = "    function int sum" + std::to_string(s) + "(Array buffer, int n) {\n"
+                                 "        var int i, total;\n"
+                                 "        let i = 0;\n"
+                                 "        let total = 0;\n"
+                                 "        while (i < n) {\n"
+                                 "            let total = total + buffer[i];\n"
+                                 "            let i = i + 1;\n"
+                                 "        }\n"
+                                 "        if (total < 0) {\n"
+                                 "            do Output.printString(\"negative total\");\n"
+                                 "        }\n"
+                                 "        return total;\n"
+                                 "    }\n";
+        out << subroutine;
+        bytes += subroutine.size();
+    }
+    out << "}\n";
+    return bytes;
+}
+
+static bool measure(const std::string& mode, const fs::path& file, bool stream)
+{
+    auto started = std::chrono::steady_clock::now();
+    pid_t child = fork();
+    if(child == 0)
+    {
+        std::freopen("/dev/null", "w", stdout); //the file names and summary the compiler prints
+        compile_options options;
+        options.stream = stream;
+        options.rebuild = true;
+        options.trace = false;
+        jack_analyzer(file.string(), options).analyze();
+        _exit(0);
+    }
+    int status = 0;
+    struct rusage usage;
+    if(child < 0 || wait4(child, &status, 0, &usage) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        std::cerr << mode << ": the compile failed" << std::endl;
+        return false;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    std::cout << mode << usage.ru_maxrss / 1024 << " MB peak, " << seconds << " s" << std::endl;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t megabytes = argc > 1 ? std::max(1, std::atoi(argv[1])) : 100;
+    fs::path dir = fs::temp_directory_path() / "bench_stream_memory";
+    fs::create_directories(dir);
+    fs::path file = dir / "Main.jack";
+    size_t bytes = write_class(file, megabytes);
+    std::cout << "class of " << bytes / 1000000 << " MB" << std::endl;
+    bool ok = measure("as usual:  ", file, false) && measure("--stream:  ", file, true);
+    fs::remove_all(dir);
+    return ok ? 0 : 1;
+}
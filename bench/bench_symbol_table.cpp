@@ -0,0 +1,131 @@
+#include "symbol_table.h"
+#include <iostream>
+#include <chrono>
+#include <unordered_map>
+
+/*
+The flat symbol_table against the unordered_map table it replaced, on the work the parser gives them: a class
+table filled once, then for every subroutine a start_subroutine, its arguments and locals defined and a run of
+variable lookups. The old table is looked up the way the parser used it, symbol_exists_of and then kind_of,
+index_of and type_of, the new one with a single resolve.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -I. bench/bench_symbol_table.cpp -o bench_symbol_table
+    ./bench_symbol_table
+*/
+
+class old_symbol_table //the table as it was before the flat one, error checks left out
+{
+    std::unordered_map<std::string,symbol> symbols;
+    std::unordered_map<kind,int> kind_count;
+public:
+    void start_subroutine()
+    {
+        kind_count[kind::arg_k] = 0;
+        kind_count[kind::var_k] = 0;
+        symbols.clear();
+    }
+
+    void define(std::string n,std::string t,kind k)
+    {
+        symbols.insert({n,symbol{n,t,k,kind_count[k]}});
+        kind_count[k]+=1;
+    }
+
+    kind kind_of(std::string str)
+    {
+        return symbols[str].ki;
+    }
+
+    std::string type_of(std::string str)
+    {
+        return symbols[str].type;
+    }
+
+    int index_of(std::string str)
+    {
+        return symbols[str].num;
+    }
+
+    bool symbol_exists_of(std::string str)
+    {
+        return symbols.find(str) != symbols.end();
+    }
+};
+
+const int subroutines = 200000;
+const char* class_vars[] = {"x", "y", "size", "buffer", "count"};
+const char* arguments[] = {"this", "dx", "dy"};
+const char* locals[] = {"i", "j", "sum", "temp", "node", "result"};
+const char* references[] = {"i", "sum", "x", "i", "buffer", "j", "dx", "count", "i", "node", "temp", "size", "result", "j", "Output", "i"}; //Output is a class name, in neither table
+
+template<typename table_t, typename lookup_t>
+static double run(table_t& class_table, table_t& subroutine_table, lookup_t lookup, long long& checksum)
+{
+    for(const char* name : class_vars)
+    {
+        class_table.define(name, "int", kind::field_k);
+    }
+    auto started = std::chrono::steady_clock::now();
+    for(int s = 0; s < subroutines; s++)
+    {
+        subroutine_table.start_subroutine();
+        for(const char* name : arguments)
+        {
+            subroutine_table.define(name, "int", kind::arg_k);
+        }
+        for(const char* name : locals)
+        {
+            subroutine_table.define(name, "Array", kind::var_k);
+        }
+        for(const char* name : references)
+        {
+            checksum += lookup(class_table, subroutine_table, name);
+        }
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count() / subroutines;
+}
+
+int main()
+{
+    long long old_sum = 0, new_sum = 0;
+    old_symbol_table old_class, old_subroutine;
+    old_class.start_subroutine();
+    double old_ns = run(old_class, old_subroutine, [](old_symbol_table& c, old_symbol_table& s, const std::string& name)
+    {
+        for(old_symbol_table* t : {&c, &s})
+        {
+            if(t->symbol_exists_of(name))
+            {
+                return t->kind_of(name) * 100 + t->index_of(name) + (long long)t->type_of(name).size();
+            }
+        }
+        return -1LL;
+    }, old_sum);
+
+    symbol_table new_class{'c'}, new_subroutine{'s'};
+    double new_ns = run(new_class, new_subroutine, [](symbol_table& c, symbol_table& s, const std::string& name)
+    {
+        for(symbol_table* t : {&c, &s})
+        {
+            symbol_ref ref = t->resolve(name);
+            if(ref.found)
+            {
+                return ref.ki * 100 + ref.num + (long long)ref.type->size();
+            }
+        }
+        return -1LL;
+    }, new_sum);
+
+    if(old_sum != new_sum)
+    {
+        std::cerr << "The tables disagree: " << old_sum << " and " << new_sum << std::endl;
+        return 1;
+    }
+    std::cout << "per subroutine, " << sizeof(arguments) / sizeof(*arguments) + sizeof(locals) / sizeof(*locals) << " symbols and "
+              << sizeof(references) / sizeof(*references) << " lookups" << std::endl;
+    std::cout << "unordered_map table:  " << old_ns << " ns" << std::endl;
+    std::cout << "flat table:           " << new_ns << " ns" << std::endl;
+    std::cout << "speedup:              " << old_ns / new_ns << "x" << std::endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#if defined(__SSE2__) && !defined(JACK_SCALAR_SCAN)
+#include <emmintrin.h>
+#endif
+
+namespace tokenizer
+{
+
+//character classes of the jack lexical rules, worked out at compile time so no call depends on the locale.
+//a character can be in more than one class, e.g. a letter is both an identifier start and an identifier char
+enum char_class_bits : unsigned char
+{
+    SYMBOL_CHAR = 1, DIGIT_CHAR = 2, IDENT_START = 4, IDENT_CHAR = 8, BLANK_CHAR = 16, SLASH_CHAR = 32, QUOTE_CHAR = 64, XML_ESCAPED = 128
+};
+
+inline constexpr const char symbol_chars[] = "{}()[].,;+-*/&|<>=~";
+inline constexpr const char blank_chars[] = " \t\r\n";
+inline constexpr const char xml_escaped_chars[] = "&<>";
+
+struct char_table
+{
+    unsigned char cls[256] = {};
+};
+
+constexpr char_table make_char_table()
+{
+    char_table t;
+    for(const char* p = symbol_chars; *p; p++) t.cls[(unsigned char)*p] |= SYMBOL_CHAR;
+    for(const char* p = blank_chars; *p; p++) t.cls[(unsigned char)*p] |= BLANK_CHAR;
+    for(const char* p = xml_escaped_chars; *p; p++) t.cls[(unsigned char)*p] |= XML_ESCAPED;
+    for(int c = '0'; c <= '9'; c++) t.cls[c] |= DIGIT_CHAR | IDENT_CHAR;
+    for(int c = 'a'; c <= 'z'; c++) t.cls[c] |= IDENT_START | IDENT_CHAR;
+    for(int c = 'A'; c <= 'Z'; c++) t.cls[c] |= IDENT_START | IDENT_CHAR;
+    t.cls[(unsigned char)'_'] |= IDENT_START | IDENT_CHAR;
+    t.cls[(unsigned char)'/'] |= SLASH_CHAR;
+    t.cls[(unsigned char)'"'] |= QUOTE_CHAR;
+    return t;
+}
+
+inline constexpr char_table char_classes = make_char_table();
+
+inline unsigned char char_class_of(char c)
+{
+    return char_classes.cls[(unsigned char)c];
+}
+
+inline std::string xml_symbol(char c) //a symbol as it is written between xml tags
+{
+    if(!(char_class_of(c) & XML_ESCAPED))
+    {
+        return std::string{c};
+    }
+    return c == '&' ? "&amp;" : c == '<' ? "&lt;" : "&gt;";
+}
+
+//scanning kernels for the tokenizer's inner loops. each one looks at 16 bytes at a time with sse2 and falls back
+//to a plain loop for the tail and on targets without it, or when built with JACK_SCALAR_SCAN to measure the
+//difference. they only work inside one line, the tokenizer carries on char by char where a run reaches the end of the line
+
+inline size_t find_char(const char* p, size_t n, char c) //index of the first c in p[0..n), n if there is none
+{
+    size_t i = 0;
+#if defined(__SSE2__) && !defined(JACK_SCALAR_SCAN)
+    const __m128i wanted = _mm_set1_epi8(c);
+    for(; i + 16 <= n; i += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i)), wanted));
+        if(mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; i < n && p[i] != c; i++);
+    return i;
+}
+
+inline size_t identifier_run(const char* p, size_t n) //length of the run of letters, digits and _ at the start of p[0..n)
+{
+    size_t i = 0;
+#if defined(__SSE2__) && !defined(JACK_SCALAR_SCAN)
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20)); //folds A-Z onto a-z, bytes above 127 stay negative
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i underscore = _mm_cmpeq_epi8(x, _mm_set1_epi8('_'));
+        int mask = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, letter), underscore)) & 0xFFFF;
+        if(mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; i < n && (char_class_of(p[i]) & IDENT_CHAR); i++);
+    return i;
+}
+
+inline size_t blank_run(const char* p, size_t n) //length of the run of spaces and tabs at the start of p[0..n)
+{
+    size_t i = 0;
+#if defined(__SSE2__) && !defined(JACK_SCALAR_SCAN)
+    for(; i + 16 <= n; i += 16)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(x, _mm_set1_epi8('\t')));
+        int mask = ~_mm_movemask_epi8(blank) & 0xFFFF;
+        if(mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for(; i < n && (p[i] == ' ' || p[i] == '\t'); i++);
+    return i;
+}
+
+}
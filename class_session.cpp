@@ -0,0 +1,318 @@
+#include "class_session.h"
+#include "vm_writer.h"
+#include <algorithm>
+
+static bool starts_subroutine(const tokenizer::token* t)
+{
+    return t != nullptr && t->type == tokenizer::token_type::KEYWORD && (t->token_name == "constructor" || t->token_name == "function" || t->token_name == "method");
+}
+
+static std::string token_listing(const tokenizer::jack_tokenizer& tokens, int begin, int end) //T.xml lines of tokens [begin, end)
+{
+    std::string listing;
+    for(int k = begin; k < end; k++)
+    {
+        listing.append(tokenizer::token_xml(*tokens.peek_token(k)));
+    }
+    return listing;
+}
+
+bool class_session::compile(const std::vector<std::string>& source, const signature_index* index)
+{
+    signatures = index;
+    header_engine.use_signatures(index);
+    compiled = 0;
+    if(!reusable || !compile_changed(source))
+    {
+        compile_all(source);
+    }
+    return errors.empty();
+}
+
+// the class a piece at a time, the same way compile_class goes through it: the header, each subroutine on a copy of
+// the engine the header left, and the closing brace
+void class_session::compile_all(const std::vector<std::string>& source)
+{
+    lines = source;
+    reusable = false;
+    pieces.clear();
+    errors.clear();
+    open_lines.clear();
+    compiled = 0;
+    tokenizer::jack_tokenizer tokens;
+    if(!tokens.lex_range(lines, 0, lines.size(), &open_lines))
+    {
+        errors.push_back(syntax_error{"Source ends inside a token, string or comment, line: ", (int)lines.size()});
+        return;
+    }
+    header_engine = compilation_engine{tokens, options};
+    header_engine.use_signatures(signatures);
+    bool finished = header_engine.compile_header(header_xml);
+    errors = header_engine.take_errors();
+    if(!finished)
+    {
+        return;
+    }
+    int position = header_engine.return_token_position();
+    header_tokens = token_listing(tokens, 0, position);
+    header_last_line = position > 0 ? tokens.peek_token(position - 1)->line_num - 1 : -1;
+    while(starts_subroutine(tokens.peek_token(position)))
+    {
+        compiled_subroutine sub = header_engine.compile_subroutine_from(tokens, position);
+        errors.insert(errors.end(), sub.errors.begin(), sub.errors.end());
+        pieces.push_back(make_piece(tokens, position, sub));
+        position = sub.end_position;
+        compiled++;
+    }
+    const tokenizer::token* brace = tokens.peek_token(position);
+    footer_line = brace != nullptr ? brace->line_num - 1 : lines.size();
+    compilation_engine footer_engine = header_engine;
+    footer_xml = footer_engine.compile_footer(tokens, position);
+    std::vector<syntax_error> footer_errors = footer_engine.take_errors();
+    errors.insert(errors.end(), footer_errors.begin(), footer_errors.end());
+    int end = position;
+    while(tokens.peek_token(end) != nullptr)
+    {
+        end++;
+    }
+    footer_tokens = token_listing(tokens, position, end);
+    reusable = errors.empty() && pieces_apart();
+}
+
+// lines [first_changed, old_end) of the last source became [first_changed, old_end + delta) of this one. the changed
+// range is widened to the subroutines it touches and lexed on its own, which gives the tokens a full lex would as
+// long as it starts and ends between tokens. false leaves the session as it was, for compile_all
+bool class_session::compile_changed(const std::vector<std::string>& source)
+{
+    int old_size = lines.size(), new_size = source.size();
+    int first_changed = 0;
+    while(first_changed < old_size && first_changed < new_size && lines[first_changed] == source[first_changed])
+    {
+        first_changed++;
+    }
+    int same_after = 0;
+    while(same_after < old_size - first_changed && same_after < new_size - first_changed && lines[old_size - 1 - same_after] == source[new_size - 1 - same_after])
+    {
+        same_after++;
+    }
+    int old_end = old_size - same_after;
+    int delta = new_size - old_size;
+    bool edited = first_changed < old_size || first_changed < new_size;
+    if(edited && (first_changed <= header_last_line || old_end > footer_line))
+    {
+        return false;
+    }
+
+    auto touched = [&](const subroutine_piece& p) //an insertion touches the subroutine it lands inside
+    {
+        if(!edited)
+        {
+            return false;
+        }
+        return first_changed == old_end ? p.first_line < first_changed && p.last_line >= first_changed : p.first_line < old_end && p.last_line >= first_changed;
+    };
+    int begin = first_changed, end = old_end;
+    for(const subroutine_piece& p : pieces)
+    {
+        if(touched(p))
+        {
+            begin = std::min(begin, p.first_line);
+            end = std::max(end, p.last_line + 1);
+        }
+    }
+    if(edited && (!starts_clean(begin) || !starts_clean(end)))
+    {
+        return false;
+    }
+
+    std::vector<subroutine_piece> kept;
+    std::vector<int> region_open;
+    int recompiled = 0;
+    bool region_done = !edited;
+    for(subroutine_piece& p : pieces) //moved from, a false return is followed by compile_all
+    {
+        if(!region_done && (touched(p) || p.first_line >= end))
+        {
+            int before = kept.size();
+            if(!compile_range(source, begin, end + delta, kept, &region_open))
+            {
+                return false;
+            }
+            recompiled += kept.size() - before;
+            region_done = true;
+        }
+        if(touched(p))
+        {
+            continue;
+        }
+        int shift = edited && p.first_line >= end ? delta : 0;
+        if(uses_changed(p))
+        {
+            if(!compile_range(source, p.first_line + shift, p.last_line + 1 + shift, kept, nullptr) || kept.back().first_line != p.first_line + shift)
+            {
+                return false;
+            }
+            recompiled++;
+            continue;
+        }
+        kept.push_back(std::move(p));
+        kept.back().first_line += shift;
+        kept.back().last_line += shift;
+    }
+    if(!region_done)
+    {
+        int before = kept.size();
+        if(!compile_range(source, begin, end + delta, kept, &region_open))
+        {
+            return false;
+        }
+        recompiled += kept.size() - before;
+    }
+
+    std::vector<int> open;
+    for(int line : open_lines)
+    {
+        if(line < begin || !edited)
+        {
+            open.push_back(line);
+        }
+        else if(line >= end)
+        {
+            open.push_back(line + delta);
+        }
+    }
+    open.insert(open.end(), region_open.begin(), region_open.end());
+    std::sort(open.begin(), open.end());
+    open_lines = std::move(open);
+    lines = source;
+    pieces = std::move(kept);
+    footer_line += edited ? delta : 0;
+    compiled = recompiled;
+    reusable = pieces_apart();
+    return true;
+}
+
+// lexes lines [begin, end) and compiles them as a run of whole subroutines. false when they aren't, or have errors,
+// which the full compile then reports
+bool class_session::compile_range(const std::vector<std::string>& source, int begin, int end, std::vector<subroutine_piece>& out, std::vector<int>* open)
+{
+    tokenizer::jack_tokenizer tokens;
+    if(!tokens.lex_range(source, begin, end, open))
+    {
+        return false;
+    }
+    int position = 0;
+    while(tokens.peek_token(position) != nullptr)
+    {
+        if(!starts_subroutine(tokens.peek_token(position)))
+        {
+            return false;
+        }
+        compiled_subroutine sub = header_engine.compile_subroutine_from(tokens, position);
+        if(!sub.errors.empty() || sub.end_position <= position)
+        {
+            return false;
+        }
+        out.push_back(make_piece(tokens, position, sub));
+        position = sub.end_position;
+    }
+    return true;
+}
+
+subroutine_piece class_session::make_piece(const tokenizer::jack_tokenizer& tokens, int position, compiled_subroutine& sub)
+{
+    subroutine_piece piece;
+    piece.first_line = tokens.peek_token(position)->line_num - 1;
+    piece.last_line = tokens.peek_token(std::max(sub.end_position - 1, position))->line_num - 1;
+    piece.tokens = token_listing(tokens, position, sub.end_position);
+    piece.xml = std::move(sub.xml);
+    piece.vm = std::move(sub.vm);
+    piece.labels = sub.labels;
+    for(const std::string& used : sub.used_signatures)
+    {
+        size_t dot = used.find('.');
+        piece.uses.emplace_back(used, signatures != nullptr ? signatures->describe(used.substr(0, dot), used.substr(dot + 1)) : "-");
+    }
+    return piece;
+}
+
+bool class_session::uses_changed(const subroutine_piece& piece) const
+{
+    for(const auto& use : piece.uses)
+    {
+        size_t dot = use.first.find('.');
+        if(signatures == nullptr || signatures->describe(use.first.substr(0, dot), use.first.substr(dot + 1)) != use.second)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool class_session::starts_clean(int line) const //the last lex reached the line between tokens
+{
+    return !std::binary_search(open_lines.begin(), open_lines.end(), line);
+}
+
+bool class_session::pieces_apart() const //no two of the header, the subroutines and the closing brace share a line
+{
+    int last = header_last_line;
+    for(const subroutine_piece& p : pieces)
+    {
+        if(p.first_line <= last)
+        {
+            return false;
+        }
+        last = p.last_line;
+    }
+    return last < footer_line;
+}
+
+std::string class_session::return_tokens() const
+{
+    std::string listing{"<token>\n"};
+    listing.append(header_tokens);
+    for(const subroutine_piece& p : pieces)
+    {
+        listing.append(p.tokens);
+    }
+    listing.append(footer_tokens);
+    listing.append("</token>\n");
+    return listing;
+}
+
+std::string class_session::return_parse_string() const
+{
+    std::string xml{header_xml};
+    for(const subroutine_piece& p : pieces)
+    {
+        xml.append(p.xml);
+    }
+    xml.append(footer_xml);
+    return xml;
+}
+
+std::string class_session::return_vm_file() const
+{
+    vm_writer writer;
+    int label_offset = 0;
+    for(const subroutine_piece& p : pieces)
+    {
+        writer.write_relabelled(p.vm, label_offset);
+        label_offset += p.labels;
+    }
+    return writer.return_vm_file();
+}
+
+std::set<std::string> class_session::return_used_signatures() const
+{
+    std::set<std::string> used;
+    for(const subroutine_piece& p : pieces)
+    {
+        for(const auto& use : p.uses)
+        {
+            used.insert(use.first);
+        }
+    }
+    return used;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include "jack_tokenizer.h"
+#include "compilation_engine.h"
+#include "compile_options.h"
+#include "signature_index.h"
+
+/*
+One class kept compiled between edits. Its outputs are kept a subroutine at a time together with the source lines
+each came from, and a new version of the source is compared line by line with the one compiled last: only the
+subroutines on changed lines, and those whose calls were checked against a signature that has changed since, are
+lexed and compiled again. The rest are shifted by the lines inserted above them and spliced back in between the
+class header and the closing brace, their labels renumbered the way the --jobs workers' are.
+
+The whole class is compiled again when an edit reaches the header or the closing brace, when a changed range starts
+or ends on a line that begins inside a token, string or comment, when the new lines aren't whole subroutines, and
+after any compile with errors, so the outputs are always the ones a full compile gives.
+*/
+
+struct subroutine_piece //one subroutine as last compiled
+{
+    int first_line = 0; //lines of its first and last token, counting from 0
+    int last_line = 0;
+    std::string tokens; //its lines of the T.xml listing
+    std::string xml;
+    std::string vm; //labels count from L1 like a worker's, renumbered when the class is put together
+    int labels = 0;
+    std::vector<std::pair<std::string,std::string>> uses; //Class.subroutine and its signature when the call was checked
+};
+
+class class_session
+{
+    compile_options options;
+    const signature_index* signatures = nullptr;
+    std::vector<std::string> lines; //the source the pieces were compiled from
+    bool reusable = false; //false until a compile succeeds with subroutines on lines of their own
+    compilation_engine header_engine; //state after the class variables, subroutines compile on copies of it
+    std::string header_tokens;
+    std::string header_xml;
+    std::string footer_tokens;
+    std::string footer_xml;
+    int header_last_line = 0;
+    int footer_line = 0; //line of the } ending the class
+    std::vector<subroutine_piece> pieces;
+    std::vector<int> open_lines; //sorted, lines that start inside a token, string or comment
+    std::vector<syntax_error> errors;
+    int compiled = 0; //subroutines compiled by the last compile, the rest were kept
+
+    void compile_all(const std::vector<std::string>& source);
+    bool compile_changed(const std::vector<std::string>& source);
+    bool compile_range(const std::vector<std::string>& source, int begin, int end, std::vector<subroutine_piece>& out, std::vector<int>* open);
+    subroutine_piece make_piece(const tokenizer::jack_tokenizer& tokens, int position, compiled_subroutine& sub);
+    bool uses_changed(const subroutine_piece& piece) const;
+    bool starts_clean(int line) const;
+    bool pieces_apart() const;
+
+public:
+    class_session(compile_options opts = {}) : options{opts} {}
+    bool compile(const std::vector<std::string>& source, const signature_index* index); //false when the source has errors
+    const std::vector<syntax_error>& return_errors() const
+    {
+        return errors;
+    }
+    std::string return_tokens() const;
+    std::string return_parse_string() const;
+    std::string return_vm_file() const;
+    std::set<std::string> return_used_signatures() const;
+    int return_compiled() const
+    {
+        return compiled;
+    }
+    int return_kept() const
+    {
+        return pieces.size() - compiled;
+    }
+};
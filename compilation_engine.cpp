@@ -1,4 +1,8 @@
 #include "compilation_engine.h"
+#include "char_scan.h"
+#include <sstream>
+#include <algorithm>
+#include <atomic>
 
 using keyword_type = tokenizer::keyword_type;
 using token_type = tokenizer::token_type;
@@ -122,6 +126,21 @@ program
 */
 
 void compilation_engine::compile_class()
+{
+    compile_class_header();
+    if(options.jobs > 1 && xml_sink == nullptr && compile_subroutines_parallel())
+    {
+        return;
+    }
+    while (jt.return_token_type() == token_type::KEYWORD && (jt.return_keyword_type() == keyword_type::CONSTRUCTOR || jt.return_keyword_type() == keyword_type::FUNCTION || jt.return_keyword_type() == keyword_type::METHOD))
+    {
+        compile_subroutine_dec();
+        stream_out(false);
+    }
+    compile_class_footer();
+}
+
+void compilation_engine::compile_class_header() //class name { classVarDec*
 {
     xs.enter_tag(std::string("class"), tab_count);
     increment_tab_count();
@@ -133,6 +152,7 @@ void compilation_engine::compile_class()
         {
             xs.enter_tag(std::string("identifier"), jt.return_identifier_string_const(), tab_count);
             class_name = jt.return_identifier_string_const();
+            mark_hot_call_sites();
             jt.advance();
             if (jt.return_token_type() == token_type::SYMBOL && jt.return_identifier_string_const() == "{")
             {
@@ -141,31 +161,22 @@ void compilation_engine::compile_class()
                 while (jt.return_token_type() == token_type::KEYWORD &&
                        (jt.return_keyword_type() == keyword_type::STATIC || jt.return_keyword_type() == keyword_type::FIELD))
                 {
+                    int start = jt.return_token_position();
                     xs.enter_tag(std::string("classVarDec"), tab_count);
                     increment_tab_count();
-                    compile_class_var_dec();
+                    parse_checkpoint cp = checkpoint();
+                    try
+                    {
+                        compile_class_var_dec();
+                    }
+                    catch(const syntax_error& e)
+                    {
+                        recover(cp, e);
+                        skip_declaration(start, true);
+                    }
                     decrement_tab_count();
                     xs.enter_tag(std::string("/classVarDec"), tab_count);
                 }
-                while (jt.return_token_type() == token_type::KEYWORD && (jt.return_keyword_type() == keyword_type::CONSTRUCTOR || jt.return_keyword_type() == keyword_type::FUNCTION || jt.return_keyword_type() == keyword_type::METHOD))
-                {
-                    xs.enter_tag(std::string("subroutineDec"), tab_count);
-                    increment_tab_count();
-                    compile_subroutine();
-                    decrement_tab_count();
-                    xs.enter_tag(std::string("/subroutineDec"), tab_count);
-                }
-                if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '}')
-                {
-                    xs.enter_tag("symbol", "}", tab_count);
-                    jt.advance();
-                    decrement_tab_count();
-                    xs.enter_tag(std::string("/class"), tab_count);
-                }
-                else
-                {
-                    error("Expected }, line: ", jt.return_linenum());
-                }
             }
             else
             {
@@ -183,11 +194,247 @@ void compilation_engine::compile_class()
     }
 }
 
+void compilation_engine::compile_class_footer()
+{
+    if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '}')
+    {
+        xs.enter_tag("symbol", "}", tab_count);
+        jt.advance();
+        decrement_tab_count();
+        xs.enter_tag(std::string("/class"), tab_count);
+        stream_out(true);
+    }
+    else
+    {
+        error("Expected }, line: ", jt.return_linenum());
+    }
+}
+
+bool compilation_engine::compile_header(std::string& xml) //false when the class can't be parsed past it, errors are left for take_errors
+{
+    bool finished = true;
+    if(!run_on_parse_stacks({[this, &finished]()
+    {
+        try
+        {
+            compile_class_header();
+        }
+        catch(const syntax_error& e)
+        {
+            record_error(e);
+            finished = false;
+        }
+    }}))
+    {
+        record_error(syntax_error{"Not enough memory for a parser stack, line: ", 0});
+        finished = false;
+    }
+    xml = std::move(xs.xml_string);
+    return finished;
+}
+
+compiled_subroutine compilation_engine::compile_subroutine_from(const tokenizer::jack_tokenizer& tokens, int position) //the engine itself is left as it was
+{
+    compilation_engine worker = *this;
+    worker.jt = tokens;
+    worker.jt.set_token_position(position);
+    worker.xs.reset();
+    worker.label_count = 0;
+    worker.errors.clear();
+    worker.used_signatures.clear();
+    if(!run_on_parse_stacks({[&worker]()
+    {
+        worker.compile_subroutine_dec();
+    }}))
+    {
+        worker.record_error(syntax_error{"Not enough memory for a parser stack, line: ", 0});
+    }
+    return compiled_subroutine{std::move(worker.xs.xml_string), worker.vm_wr.return_vm_file(), worker.label_count, std::move(worker.errors),
+                               std::move(worker.used_signatures), worker.jt.return_token_position()};
+}
+
+std::string compilation_engine::compile_footer(const tokenizer::jack_tokenizer& tokens, int position)
+{
+    jt = tokens;
+    jt.set_token_position(position);
+    xs.reset();
+    if(!run_on_parse_stacks({[this]()
+    {
+        try
+        {
+            compile_class_footer();
+        }
+        catch(const syntax_error& e)
+        {
+            record_error(e);
+        }
+    }}))
+    {
+        record_error(syntax_error{"Not enough memory for a parser stack, line: ", 0});
+    }
+    return std::move(xs.xml_string);
+}
+
+// nothing is rolled back across a subroutine boundary, so once one is compiled its output is final and its
+// tokens are never read again
+void compilation_engine::stream_out(bool at_end)
+{
+    if(xml_sink == nullptr)
+    {
+        return;
+    }
+    *xml_sink << xs.xml_string;
+    xs.reset();
+    *vm_sink << vm_wr.take_code();
+    int pos = jt.return_token_position();
+    for(const tokenizer::token* t; (t = jt.peek_token(streamed_tokens - pos)) != nullptr && (at_end || streamed_tokens < pos); streamed_tokens++)
+    {
+        *token_sink << tokenizer::token_xml(*t);
+    }
+    jt.release_tokens_before(pos);
+}
+
+// the subroutines only share the class symbol table, which is complete once the class variables are compiled.
+// each worker compiles whole subroutines on its own copy of the engine with label numbers starting over, the
+// results are joined in source order and the labels renumbered, so the output is the same as compiling in order.
+// a class with syntax errors is compiled again in order instead: a stray brace throws off the brace matching that
+// finds the subroutines, and only the sequential parse reports the errors the way a compile without --jobs does
+bool compilation_engine::compile_subroutines_parallel() //true when the rest of the class, its closing brace included, compiled without errors
+{
+    std::vector<int> starts;
+    int end = find_subroutine_starts(starts);
+    if(end < 0 || starts.size() < 2) //unbalanced braces, left to the sequential loop so errors are reported the usual way
+    {
+        return false;
+    }
+    int start = jt.return_token_position();
+    size_t xml_pos = xs.xml_string.size();
+    vm_writer_state vm_state = vm_wr.save();
+    int labels = label_count;
+    int tabs = tab_count;
+    size_t error_count = errors.size();
+    std::set<std::string> signatures_before = used_signatures;
+
+    std::vector<compiled_subroutine> results(starts.size());
+    std::atomic<size_t> next{0};
+    int jobs = std::min<int>(options.jobs, starts.size());
+    std::vector<std::function<void()>> workers;
+    for(int w = 0; w < jobs; w++)
+    {
+        workers.push_back([this, &starts, &results, &next]()
+        {
+            compilation_engine worker = *this;
+            const vm_writer empty_writer = worker.vm_wr;
+            for(size_t i = next++; i < starts.size(); i = next++)
+            {
+                worker.jt.set_token_position(starts[i]);
+                worker.xs.reset();
+                worker.vm_wr = empty_writer;
+                worker.label_count = 0;
+                worker.errors.clear();
+                worker.used_signatures.clear();
+                worker.compile_subroutine_dec();
+                results[i] = compiled_subroutine{std::move(worker.xs.xml_string), worker.vm_wr.return_vm_file(), worker.label_count, std::move(worker.errors), std::move(worker.used_signatures)};
+            }
+        });
+    }
+    bool failed = !run_on_parse_stacks(workers); //the class is compiled in order on this stack instead
+    for(const compiled_subroutine& r : results)
+    {
+        failed = failed || !r.errors.empty();
+    }
+    if(!failed)
+    {
+        for(const compiled_subroutine& r : results)
+        {
+            xs.xml_string.append(r.xml);
+            vm_wr.write_relabelled(r.vm, label_count);
+            label_count += r.labels;
+            used_signatures.insert(r.used_signatures.begin(), r.used_signatures.end());
+        }
+        jt.set_token_position(end);
+        try
+        {
+            compile_class_footer();
+        }
+        catch(const syntax_error&) //the brace matching took a brace inside the class for its end
+        {
+            failed = true;
+        }
+    }
+    if(failed)
+    {
+        jt.set_token_position(start);
+        xs.xml_string.resize(xml_pos);
+        vm_wr.restore(vm_state);
+        label_count = labels;
+        tab_count = tabs;
+        errors.resize(error_count);
+        used_signatures = signatures_before;
+    }
+    return !failed;
+}
+
+void compilation_engine::compile_subroutine_dec()
+{
+    int start = jt.return_token_position();
+    xs.enter_tag(std::string("subroutineDec"), tab_count);
+    increment_tab_count();
+    parse_checkpoint cp = checkpoint();
+    try
+    {
+        compile_subroutine();
+    }
+    catch(const syntax_error& e)
+    {
+        recover(cp, e);
+        skip_declaration(start, false);
+    }
+    decrement_tab_count();
+    xs.enter_tag(std::string("/subroutineDec"), tab_count);
+}
+
+int compilation_engine::find_subroutine_starts(std::vector<int>& starts) //token positions of the remaining subroutines, returns the position after the last one or -1
+{
+    int start = jt.return_token_position();
+    int pos = 0;
+    const tokenizer::token* t = jt.peek_token(0);
+    while(t != nullptr && t->type == token_type::KEYWORD &&
+          (t->token_name == "constructor" || t->token_name == "function" || t->token_name == "method"))
+    {
+        starts.push_back(start + pos);
+        while((t = jt.peek_token(pos)) != nullptr && !(t->type == token_type::SYMBOL && t->token_name == "{"))
+        {
+            pos++;
+        }
+        int depth = 0;
+        while((t = jt.peek_token(pos)) != nullptr)
+        {
+            if(t->type == token_type::SYMBOL && t->token_name == "{")
+            {
+                depth++;
+            }
+            else if(t->type == token_type::SYMBOL && t->token_name == "}" && --depth == 0)
+            {
+                break;
+            }
+            pos++;
+        }
+        if(t == nullptr)
+        {
+            return -1;
+        }
+        pos++;
+        t = jt.peek_token(pos);
+    }
+    return start + pos;
+}
+
 void compilation_engine::compile_class_var_dec() // compiles and create parse tree for the class variables, defines the variables in the symbol tree
 {
     std::string var_name, type;
 
-    kind ki;
+    kind ki = kind::NONE;
 
     xs.enter_tag("keyword", tokenizer::KEYWORDS[jt.return_keyword_type()], tab_count);
     if (jt.return_keyword_type() == keyword_type::FIELD)
@@ -251,6 +498,8 @@ void compilation_engine::compile_subroutine()
     current_return_type = "";
     symboltable_subroutine.start_subroutine();
     subroutine_local_variable_count = 0; //resetting the local variable count
+    licm.max = 0;
+    if_ordinal = 0;
     xs.enter_tag("keyword", tokenizer::KEYWORDS[jt.return_keyword_type()], tab_count);
     if (jt.return_keyword_type() == keyword_type::CONSTRUCTOR)
     {
@@ -301,7 +550,10 @@ void compilation_engine::compile_subroutine()
 
         {
             current_return_type = tokenizer::KEYWORDS[jt.return_keyword_type()];
-            std::cout << current_return_type << std::endl;
+            if(options.trace)
+            {
+                std::cout << current_return_type << std::endl;
+            }
             xs.enter_tag("keyword", tokenizer::KEYWORDS[jt.return_keyword_type()], tab_count);
             jt.advance();
         }
@@ -373,7 +625,11 @@ void compilation_engine::compile_subroutine_body()
         decrement_tab_count();
         xs.enter_tag("/varDec", tab_count);
     }
-    symboltable_subroutine.print_symbols();
+    if(options.trace)
+    {
+        symboltable_subroutine.print_symbols();
+    }
+    size_t function_line = vm_wr.mark();
     vm_wr.write_function(class_name + "." + current_subroutine_name, subroutine_local_variable_count);
     if(sub_type == subroutine_type::constructor)
     {
@@ -391,6 +647,11 @@ void compilation_engine::compile_subroutine_body()
     compile_statements();
     decrement_tab_count();
     xs.enter_tag("/statements", tab_count);
+    vm_wr.write_cold_code();
+    if(licm.max > 0) //locals holding hoisted loop invariants come after the declared ones
+    {
+        vm_wr.rewrite_function(function_line, class_name + "." + current_subroutine_name, subroutine_local_variable_count + licm.max);
+    }
     if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '}')
     {
         xs.enter_tag("symbol", "}", tab_count);
@@ -492,7 +753,10 @@ void compilation_engine::compile_var_dec()
     {
         error("Expected identifier, line:", jt.return_linenum());
     }
-    std::cout << var_name << " " << type << " " << ki << std::endl;
+    if(options.trace)
+    {
+        std::cout << var_name << " " << type << " " << ki << std::endl;
+    }
     symboltable_subroutine.define(var_name, type, ki); //define the variable in symbol table
     subroutine_local_variable_count++;
 
@@ -533,57 +797,206 @@ void compilation_engine::compile_var_dec()
 
 void compilation_engine::compile_statements()
 {
-    while (jt.return_token_type() == token_type::KEYWORD && (jt.return_keyword_type() == keyword_type::IF || jt.return_keyword_type() == keyword_type::LET ||
-                                                             jt.return_keyword_type() == keyword_type::WHILE || jt.return_keyword_type() == keyword_type::DO || jt.return_keyword_type() == keyword_type::RETURN))
+    nested([this]()
     {
-        if (jt.return_keyword_type() == keyword_type::LET)
+        compile_statement_list();
+    });
+}
+
+void compilation_engine::compile_statement_list()
+{
+    //anything up to the } closing the block is a statement, one that doesn't start with a statement keyword is an error
+    //and skipped like any other broken statement. a class member keyword also ends the list, the } before it is missing
+    for(const tokenizer::token* t; (t = jt.peek_token(0)) != nullptr && !(t->type == token_type::SYMBOL && t->token_name == "}") &&
+                                   !(t->type == token_type::KEYWORD && (t->token_name == "constructor" || t->token_name == "function" || t->token_name == "method"));)
+    {
+        int start = jt.return_token_position();
+        parse_checkpoint cp = checkpoint();
+        try
         {
-            xs.enter_tag("letStatement", tab_count);
-            increment_tab_count();
-            compile_let();
-            decrement_tab_count();
-            xs.enter_tag("/letStatement", tab_count);
+            if (jt.return_token_type() != token_type::KEYWORD)
+            {
+                error("Expected statement, line: ", jt.return_linenum());
+            }
+            else if (jt.return_keyword_type() == keyword_type::LET)
+            {
+                xs.enter_tag("letStatement", tab_count);
+                increment_tab_count();
+                compile_let();
+                decrement_tab_count();
+                xs.enter_tag("/letStatement", tab_count);
+            }
+            else if (jt.return_keyword_type() == keyword_type::DO)
+            {
+                xs.enter_tag("doStatement", tab_count);
+                increment_tab_count();
+                compile_do();
+                decrement_tab_count();
+                xs.enter_tag("/doStatement", tab_count);
+            }
+            else if (jt.return_keyword_type() == keyword_type::WHILE)
+            {
+                xs.enter_tag("whileStatement", tab_count);
+                increment_tab_count();
+                compile_while();
+                decrement_tab_count();
+                xs.enter_tag("/whileStatement", tab_count);
+            }
+            else if (jt.return_keyword_type() == keyword_type::RETURN)
+            {
+                xs.enter_tag("returnStatement", tab_count);
+                increment_tab_count();
+                compile_return();
+                decrement_tab_count();
+                xs.enter_tag("/returnStatement", tab_count);
+            }
+            else if (jt.return_keyword_type() == keyword_type::IF)
+            {
+                xs.enter_tag("ifStatement", tab_count);
+                increment_tab_count();
+                compile_if();
+                decrement_tab_count();
+                xs.enter_tag("/ifStatement", tab_count);
+            }
+            else
+            {
+                error("Expected statement, line: ", jt.return_linenum());
+            }
         }
-        else if (jt.return_keyword_type() == keyword_type::DO)
+        catch(const syntax_error& e)
         {
-            xs.enter_tag("doStatement", tab_count);
-            increment_tab_count();
-            compile_do();
-            decrement_tab_count();
-            xs.enter_tag("/doStatement", tab_count);
+            recover(cp, e);
+            skip_statement(start);
+        }
+    }
+    return;
+}
+
+// panic mode recovery: a statement or declaration that fails to parse has its error recorded, the engine state
+// it may have left half changed is put back and tokens are skipped to a point where parsing can carry on. the
+// output is thrown away once there is an error, only the token position and the nesting counters must be right
+parse_checkpoint compilation_engine::checkpoint() const
+{
+    return parse_checkpoint{tab_count, nesting, expression_depth, cse_suspended, licm.dry_run, licm.live, licm.depth};
+}
+
+void compilation_engine::recover(const parse_checkpoint& cp, const syntax_error& e)
+{
+    record_error(e);
+    tab_count = cp.tab_count;
+    nesting = cp.nesting;
+    expression_depth = cp.expression_depth;
+    cse_suspended = cp.cse_suspended;
+    cse = cse_state{};
+    licm.dry_run = cp.licm_dry_run;
+    for(auto it = licm.text_of.begin(); it != licm.text_of.end();) //invariants hoisted by loops the error unwound out of
+    {
+        if(it->first >= subroutine_local_variable_count + cp.licm_live)
+        {
+            licm.local_of.erase(it->second);
+            it = licm.text_of.erase(it);
         }
-        else if (jt.return_keyword_type() == keyword_type::WHILE)
+        else
         {
-            xs.enter_tag("whileStatement", tab_count);
-            increment_tab_count();
-            compile_while();
-            decrement_tab_count();
-            xs.enter_tag("/whileStatement", tab_count);
+            it++;
         }
-        else if (jt.return_keyword_type() == keyword_type::RETURN)
+    }
+    licm.live = cp.licm_live;
+    licm.depth = cp.licm_depth;
+}
+
+void compilation_engine::skip_statement(int start) //to just after the next ;, or to the next statement keyword or } that ends the block
+{
+    if(jt.return_token_position() == start)
+    {
+        jt.advance();
+    }
+    for(const tokenizer::token* t; (t = jt.peek_token(0)) != nullptr; jt.advance())
+    {
+        if(t->type == token_type::SYMBOL && t->token_name == ";")
         {
-            xs.enter_tag("returnStatement", tab_count);
-            increment_tab_count();
-            compile_return();
-            decrement_tab_count();
-            xs.enter_tag("/returnStatement", tab_count);
+            jt.advance();
+            return;
         }
-        else if (jt.return_keyword_type() == keyword_type::IF)
+        if(t->type == token_type::SYMBOL && t->token_name == "}")
         {
-            xs.enter_tag("ifStatement", tab_count);
-            increment_tab_count();
-            compile_if();
-            decrement_tab_count();
-            xs.enter_tag("/ifStatement", tab_count);
+            return;
+        }
+        if(t->type == token_type::KEYWORD && (t->token_name == "let" || t->token_name == "do" || t->token_name == "if" || t->token_name == "while" || t->token_name == "return"))
+        {
+            return;
+        }
+        if(t->type == token_type::SYMBOL && t->token_name == "{") //the body of a broken if or while goes with it
+        {
+            skip_block();
+            if(jt.return_token_type() == token_type::KEYWORD && jt.return_keyword_type() == keyword_type::ELSE)
+            {
+                jt.advance();
+                if(jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '{')
+                {
+                    skip_block();
+                }
+            }
+            return;
+        }
+    }
+}
+
+void compilation_engine::skip_declaration(int start, bool class_var) //to the next class member, or to the } closing the class
+{
+    if(jt.return_token_position() == start)
+    {
+        jt.advance();
+    }
+    int depth = 0;
+    for(const tokenizer::token* t; (t = jt.peek_token(0)) != nullptr; jt.advance())
+    {
+        if(t->type == token_type::KEYWORD && (t->token_name == "constructor" || t->token_name == "function" || t->token_name == "method" ||
+                                              (class_var && (t->token_name == "static" || t->token_name == "field"))))
+        {
+            return;
+        }
+        if(class_var && depth == 0 && t->type == token_type::SYMBOL && t->token_name == ";")
+        {
+            jt.advance();
+            return;
+        }
+        if(t->type == token_type::SYMBOL && t->token_name == "{")
+        {
+            depth++;
+        }
+        else if(t->type == token_type::SYMBOL && t->token_name == "}" && --depth < 0)
+        {
+            return;
+        }
+    }
+}
+
+void compilation_engine::skip_block() //from a { to just after its matching }
+{
+    int depth = 0;
+    for(const tokenizer::token* t; (t = jt.peek_token(0)) != nullptr;)
+    {
+        jt.advance();
+        if(t->type == token_type::SYMBOL && t->token_name == "{")
+        {
+            depth++;
+        }
+        else if(t->type == token_type::SYMBOL && t->token_name == "}" && --depth == 0)
+        {
+            return;
         }
     }
-    return;
 }
 
 void compilation_engine::compile_let()
 {
     std::string target;
     bool is_array = false;
+    bool found_base = false, fold_index = false;
+    segments base_seg = segments::CONST;
+    int base_index = 0;
+    array_index ix;
     xs.enter_tag("keyword", "let", tab_count);
     jt.advance();
     if (jt.return_token_type() == token_type::IDENTIFIER)
@@ -599,38 +1012,27 @@ void compilation_engine::compile_let()
 
     if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '[')
     {
-        if(symboltable_class.symbol_exists_of(target))
+        variable_ref base = resolve(target);
+        found_base = base.found;
+        base_seg = base.seg;
+        base_index = base.index;
+        ix = classify_array_index();
+        // the store is addressed after the value is computed, so only locals and arguments that no call can change qualify
+        fold_index = found_base && ix.known && (base_seg == segments::LOCAL || base_seg == segments::ARG) &&
+                     (ix.var_index == -1 || ix.var_seg == segments::LOCAL || ix.var_seg == segments::ARG);
+        size_t index_code = vm_wr.mark();
+        if(found_base && !fold_index)
         {
-            segments seg = segments::ARG;
-            if(symboltable_class.kind_of(target) == kind::static_k)
-            {
-                seg = segments::STATIC;
-            }
-            else if(symboltable_class.kind_of(target) == kind::field_k)
-            {
-                seg = segments::THIS;
-            }
-            vm_wr.write_push(seg,symboltable_class.index_of(target));
-        }
-        else if(symboltable_subroutine.symbol_exists_of(target))
-        {
-            segments seg = segments::ARG;
-            if(symboltable_subroutine.kind_of(target) == kind::arg_k)
-            {
-                seg = segments::ARG;
-            }
-            else if(symboltable_subroutine.kind_of(target) == kind::var_k)
-            {
-                seg = segments::LOCAL;
-            }
-            vm_wr.write_push(seg,symboltable_subroutine.index_of(target));
+            vm_wr.write_push(base_seg,base_index);
         }
         is_array = true;
         xs.enter_tag("symbol", "[", tab_count);
         jt.advance();
         xs.enter_tag("expression", tab_count);
         increment_tab_count();
+        cse_suspended += fold_index;
         compile_expression();
+        cse_suspended -= fold_index;
         decrement_tab_count();
         xs.enter_tag("/expression", tab_count);
         if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == ']')
@@ -642,7 +1044,14 @@ void compilation_engine::compile_let()
         {
             error("Expected ], line: ", jt.return_linenum());
         }
-        vm_wr.write_arithmetic(command::ADD);
+        if(fold_index)
+        {
+            vm_wr.rollback(index_code);
+        }
+        else
+        {
+            vm_wr.write_arithmetic(command::ADD);
+        }
     }
     
 
@@ -660,8 +1069,15 @@ void compilation_engine::compile_let()
     compile_expression();
     decrement_tab_count();
     xs.enter_tag("/expression", tab_count);
-    segments seg = segments::CONST;
-    if(is_array)
+    if(is_array && fold_index)
+    {
+        if(!vm_wr.that_address_is(array_address(base_seg, base_index, ix)))
+        {
+            write_array_address(base_seg, base_index, ix);
+        }
+        vm_wr.write_pop(segments::THAT,ix.offset);
+    }
+    else if(is_array)
     {
         vm_wr.write_pop(segments::TEMP,0);
         vm_wr.write_pop(segments::POINTER,1);
@@ -670,30 +1086,10 @@ void compilation_engine::compile_let()
     }
     else
     {
-        if(symboltable_class.symbol_exists_of(target))
-        {
-            if(symboltable_class.kind_of(target) == kind::static_k)
-            {
-                seg = segments::STATIC;
-            }
-            else if(symboltable_class.kind_of(target) == kind::field_k)
-            {
-                seg = segments::THIS;
-            }
-            vm_wr.write_pop(seg,symboltable_class.index_of(target));
-        }
-        else if(symboltable_subroutine.symbol_exists_of(target))
+        variable_ref var = resolve(target);
+        if(var.found)
         {
-            
-            if(symboltable_subroutine.kind_of(target) == kind::arg_k)
-            {
-                seg = segments::ARG;
-            }
-            else if(symboltable_subroutine.kind_of(target) == kind::var_k)
-            {
-                seg = segments::LOCAL;
-            }
-            vm_wr.write_pop(seg,symboltable_subroutine.index_of(target));
+            vm_wr.write_pop(var.seg,var.index);
         }
     }
     
@@ -737,6 +1133,7 @@ void compilation_engine::compile_do()
         {
             error("Expected ) , line: ", jt.return_linenum());
         }
+        check_call(class_name, id1, num_of_args, call_form::bare_call);
         vm_wr.write_call(class_name + "." + id1,num_of_args);
         vm_wr.write_pop(segments::TEMP,0);
     }
@@ -776,37 +1173,15 @@ void compilation_engine::compile_do()
             {
                 error("Expected ) , line: ", jt.return_linenum());
             }
-            if(symboltable_class.symbol_exists_of(id1))
+            variable_ref var = resolve(id1);
+            check_call(var.found ? *var.type : id1, id2, num_of_args, var.found ? call_form::object_call : call_form::class_call);
+            if(var.found)
             {
-                segments seg;
-                if(symboltable_class.kind_of(id1) == kind::static_k)
-                {
-                    seg = segments::STATIC;
-                }
-                else if(symboltable_class.kind_of(id1) == kind::field_k)
-                {
-                    seg = segments::THIS;
-                }
-                vm_wr.write_push(seg,symboltable_class.index_of(id1));
-                vm_wr.write_call(symboltable_class.type_of(id1) + "." + id2,num_of_args + 1);
-                vm_wr.write_pop(segments::TEMP,0);
-            }
-            else if(symboltable_subroutine.symbol_exists_of(id1))
-            {
-                segments seg;
-                if(symboltable_subroutine.kind_of(id1) == kind::var_k)
-                {
-                    seg = segments::LOCAL;
-                }
-                else if(symboltable_subroutine.kind_of(id1) == kind::arg_k)
-                {
-                    seg = segments::ARG;
-                }
-                vm_wr.write_push(seg,symboltable_subroutine.index_of(id1));
-                vm_wr.write_call(symboltable_subroutine.type_of(id1) + "." + id2,num_of_args + 1);
+                vm_wr.write_push(var.seg,var.index);
+                vm_wr.write_call(*var.type + "." + id2,num_of_args + 1);
                 vm_wr.write_pop(segments::TEMP,0);
             }
-            else
+            else if(!compile_intrinsic(id1, id2, num_of_args, true))
             {
                 vm_wr.write_call(id1 + "." + id2 , num_of_args);
                 vm_wr.write_pop(segments::TEMP,0);
@@ -831,6 +1206,7 @@ void compilation_engine::compile_if()
 {
     label_count += 1;
     int this_label_count = label_count;
+    bool cold_then = then_is_cold(if_ordinal++);
     xs.enter_tag("keyword", "if", tab_count);
     jt.advance();
     if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '(')
@@ -842,8 +1218,15 @@ void compilation_engine::compile_if()
         compile_expression();
         decrement_tab_count();
         xs.enter_tag("/expression", tab_count);
-        vm_wr.write_arithmetic(command::NOT);
-        vm_wr.write_if(std::string("L") + std::to_string(this_label_count) + "_initial");
+        if(cold_then) // the then block is moved after the function so the common path falls through
+        {
+            vm_wr.write_if(std::string("L") + std::to_string(this_label_count) + "_then");
+        }
+        else
+        {
+            vm_wr.write_arithmetic(command::NOT);
+            vm_wr.write_if(std::string("L") + std::to_string(this_label_count) + "_initial");
+        }
         if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == ')')
         {
             xs.enter_tag("symbol", ")", tab_count);
@@ -852,6 +1235,12 @@ void compilation_engine::compile_if()
             {
                 xs.enter_tag("symbol", "{", tab_count);
                 jt.advance();
+                size_t then_code = vm_wr.mark();
+                std::vector<std::string> that_after_branch = vm_wr.return_that_address();
+                if(cold_then)
+                {
+                    vm_wr.write_label(std::string("L") + std::to_string(this_label_count) + "_then");
+                }
                 xs.enter_tag("statements", tab_count);
                 increment_tab_count();
                 compile_statements();
@@ -862,9 +1251,17 @@ void compilation_engine::compile_if()
                     xs.enter_tag("symbol", "}", tab_count);
                     jt.advance();
                     vm_wr.write_goto(std::string("L") + std::to_string(this_label_count) + "_end");
-                    vm_wr.write_label(std::string("L") + std::to_string(this_label_count) + "_initial");
+                    if(cold_then)
+                    {
+                        vm_wr.move_to_cold(then_code);
+                        vm_wr.set_that_address(that_after_branch);
+                    }
+                    else
+                    {
+                        vm_wr.write_label(std::string("L") + std::to_string(this_label_count) + "_initial");
+                    }
                     if (jt.return_token_type() == token_type::KEYWORD && jt.return_keyword_type() == keyword_type::ELSE)
-                        compile_else(this_label_count);
+                        compile_else();
                     
                     vm_wr.write_label(std::string("L") + std::to_string(this_label_count) + "_end");
                     return;
@@ -891,7 +1288,40 @@ void compilation_engine::compile_if()
     return;
 }
 
-void compilation_engine::compile_else(int this_label_count) // this is technically part of if
+bool compilation_engine::then_is_cold(int ordinal) //true when the profile saw the condition true less than one time in five
+{
+    if(profile == nullptr)
+    {
+        return false;
+    }
+    auto it = profile->branches.find(class_name + "." + current_subroutine_name + " " + std::to_string(ordinal));
+    return it != profile->branches.end() && it->second.true_count * 4 < it->second.false_count;
+}
+
+// calls inside this class that take at least one in twenty of all profiled calls are written with the inline marker
+void compilation_engine::mark_hot_call_sites()
+{
+    if(profile == nullptr)
+    {
+        return;
+    }
+    std::unordered_set<std::string> sites;
+    long long total = profile->total_calls();
+    std::string prefix = class_name + ".";
+    for(const auto& it : profile->calls)
+    {
+        std::istringstream fields(it.first);
+        std::string caller, callee;
+        fields >> caller >> callee;
+        if(caller.rfind(prefix,0) == 0 && callee.rfind(prefix,0) == 0 && it.second * 20 >= total)
+        {
+            sites.insert(it.first);
+        }
+    }
+    vm_wr.set_inline_sites(sites);
+}
+
+void compilation_engine::compile_else() // this is technically part of if
 {
     xs.enter_tag("keyword", "else", tab_count);
     jt.advance();
@@ -921,7 +1351,99 @@ void compilation_engine::compile_else(int this_label_count) // this is technical
     }
 }
 
+// The loop is compiled once to collect its pure subexpressions and the variables it assigns. Invariant ones are then computed
+// into fresh locals before the loop and the loop is compiled again using those locals. Loops nested in a loop that is being
+// analysed are compiled plainly; they are analysed in the outer loop's second pass, down to licm_max_depth loops.
 void compilation_engine::compile_while()
+{
+    if(licm.dry_run || cse_suspended > 0 || licm.depth >= licm_max_depth)
+    {
+        compile_while_body();
+        return;
+    }
+
+    int token_pos = jt.return_token_position();
+    size_t xml_pos = xs.xml_string.size();
+    vm_writer_state vm_state = vm_wr.save();
+    int labels = label_count;
+    int ifs = if_ordinal;
+
+    licm.dry_run = true;
+    licm.candidates.clear();
+    compile_while_body();
+    licm.dry_run = false;
+
+    loop_effects loop = scan_loop(vm_wr.code_since(vm_state));
+    std::vector<size_t> invariant; //indexes of the invariant candidates, by start and then by the larger span first
+    for(size_t i = 0; i < licm.candidates.size(); i++)
+    {
+        if(licm_invariant(std::get<2>(licm.candidates[i]), loop))
+        {
+            invariant.push_back(i);
+        }
+    }
+    std::sort(invariant.begin(), invariant.end(), [this](size_t a, size_t b)
+    {
+        return std::get<0>(licm.candidates[a]) != std::get<0>(licm.candidates[b]) ? std::get<0>(licm.candidates[a]) < std::get<0>(licm.candidates[b])
+                                                                                   : std::get<1>(licm.candidates[a]) > std::get<1>(licm.candidates[b]);
+    });
+    std::vector<bool> outermost(licm.candidates.size(), false); //only the largest invariant subexpressions are hoisted
+    size_t end_before = 0; //furthest end of the invariant candidates starting before the current one
+    for(size_t k = 0, group = 0; k < invariant.size(); k++)
+    {
+        const auto& [start, end, canonical] = licm.candidates[invariant[k]];
+        if(start != std::get<0>(licm.candidates[invariant[group]]))
+        {
+            for(size_t g = group; g < k; g++)
+            {
+                end_before = std::max(end_before, std::get<1>(licm.candidates[invariant[g]]));
+            }
+            group = k;
+        }
+        outermost[invariant[k]] = end_before < end && std::get<1>(licm.candidates[invariant[group]]) == end;
+    }
+    std::vector<std::string> hoisted;
+    std::unordered_set<std::string> hoisted_text;
+    for(size_t i = 0; i < licm.candidates.size(); i++)
+    {
+        if(outermost[i] && hoisted_text.insert(std::get<2>(licm.candidates[i])).second)
+        {
+            hoisted.push_back(std::get<2>(licm.candidates[i]));
+        }
+    }
+    licm.candidates.clear();
+    if(hoisted.empty())
+    {
+        return;
+    }
+
+    jt.set_token_position(token_pos);
+    xs.xml_string.resize(xml_pos);
+    vm_wr.restore(vm_state);
+    label_count = labels;
+    if_ordinal = ifs;
+    for(const std::string& canonical : hoisted)
+    {
+        int local = subroutine_local_variable_count + licm.live;
+        licm.live += 1;
+        licm.max = std::max(licm.max, licm.live);
+        licm.local_of[canonical] = local;
+        licm.text_of[local] = canonical;
+        vm_wr.write_code(canonical);
+        vm_wr.write_pop(segments::LOCAL,local);
+    }
+    licm.depth += 1;
+    compile_while_body();
+    licm.depth -= 1;
+    for(const std::string& canonical : hoisted)
+    {
+        licm.text_of.erase(licm.local_of[canonical]);
+        licm.local_of.erase(canonical);
+    }
+    licm.live -= hoisted.size();
+}
+
+void compilation_engine::compile_while_body()
 {
     label_count += 1;
     int this_label = label_count;
@@ -1031,8 +1553,56 @@ void compilation_engine::compile_return() // parses return statement
 //--------------------------------------------------------------------------------------------------------------------------------------------------------------------
 // This part is parses the expression term--------------------------------------------------------------
 
+// Top level expressions are compiled twice when a pure subexpression repeats: the first pass only counts the subexpressions,
+// the second keeps the first value of each repeated one in a temp slot and pushes that slot for the later copies.
+// Nested expressions are compiled once as part of their top level expression.
 void compilation_engine::compile_expression()
 {
+    expression_depth += 1;
+    if(expression_depth > 1 || cse_suspended > 0)
+    {
+        compile_expression_body();
+        expression_depth -= 1;
+        return;
+    }
+
+    int token_pos = jt.return_token_position();
+    size_t xml_pos = xs.xml_string.size();
+    vm_writer_state vm_state = vm_wr.save();
+    int labels = label_count;
+
+    cse = cse_state{};
+    compile_expression_body();
+    bool repeated = false;
+    for(const auto& it : cse.count)
+    {
+        if(it.second > 1)
+        {
+            repeated = true;
+        }
+    }
+    if(repeated)
+    {
+        jt.set_token_position(token_pos);
+        xs.xml_string.resize(xml_pos);
+        vm_wr.restore(vm_state);
+        label_count = labels;
+        cse.seen.clear();
+        cse.reusing = true;
+        while(!licm.candidates.empty() && std::get<0>(licm.candidates.back()) >= vm_state.size)
+        {
+            licm.candidates.pop_back();
+        }
+        compile_expression_body();
+    }
+    cse = cse_state{};
+    expression_depth -= 1;
+}
+
+void compilation_engine::compile_expression_body()
+{
+    size_t expression_start = vm_wr.mark();
+    std::vector<std::string> that_at_start = vm_wr.return_that_address();
     xs.enter_tag("term", tab_count);
     increment_tab_count();
     compile_term();
@@ -1042,107 +1612,27 @@ void compilation_engine::compile_expression()
     {
         while (true)
         {
-            switch (jt.return_symbol())
+            char op = jt.return_symbol();
+            if (operators.binary[(unsigned char)op] >= 0)
             {
-            case '+':
                 jt.advance();
-                xs.enter_tag("symbol", "+", tab_count);
+                xs.enter_tag("symbol", tokenizer::xml_symbol(op), tab_count);
                 xs.enter_tag("term", tab_count);
                 increment_tab_count();
                 compile_term();
                 decrement_tab_count();
                 xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::ADD);
-                break;
-            case '-':
-                jt.advance();
-                xs.enter_tag("symbol", "-", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::SUB);
-                break;
-            case '*':
-                jt.advance();
-                xs.enter_tag("symbol", "*", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::MUL);
-                break;
-            case '/':
-                jt.advance();
-                xs.enter_tag("symbol", "/", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::DIV);
-                break;
-            case '&':
-                jt.advance();
-                xs.enter_tag("symbol", "&amp;", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::AND);
-                break;
-            case '|':
-                jt.advance();
-                xs.enter_tag("symbol", "|", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::OR);
-                break;
-            case '<':
-                jt.advance();
-                xs.enter_tag("symbol", "&lt;", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::LT);
-                break;
-            case '>':
-                jt.advance();
-                xs.enter_tag("symbol", "&gt;", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::GT);
-                break;
-            case '=':
-                jt.advance();
-                xs.enter_tag("symbol", "=", tab_count);
-                xs.enter_tag("term", tab_count);
-                increment_tab_count();
-                compile_term();
-                decrement_tab_count();
-                xs.enter_tag("/term", tab_count);
-                vm_wr.write_arithmetic(command::EQ);
-                break;
-            case ',':
-            case ';':
-            case ')':
-            case ']':
+                vm_wr.write_arithmetic(static_cast<command>(operators.binary[(unsigned char)op]));
+            }
+            else if (op == ',' || op == ';' || op == ')' || op == ']')
+            {
                 return;
-            default:
+            }
+            else
+            {
                 error("invalid operand, line", jt.return_linenum());
-                break;
             }
+            cse_subexpression(expression_start, that_at_start); //the expression so far, operators are applied left to right
         }
     }
     else
@@ -1152,6 +1642,17 @@ void compilation_engine::compile_expression()
 }
 
 void compilation_engine::compile_term()
+{
+    nested([this]()
+    {
+        size_t start = vm_wr.mark();
+        std::vector<std::string> that_at_start = vm_wr.return_that_address();
+        compile_term_body();
+        cse_subexpression(start, that_at_start);
+    });
+}
+
+void compilation_engine::compile_term_body()
 {
     if (jt.return_token_type() == token_type::INT_CONST)
     {
@@ -1210,42 +1711,40 @@ void compilation_engine::compile_term()
         jt.advance();
         if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == '[')
         {
-            if(symboltable_class.symbol_exists_of(id1))
-            {
-                segments seg;
-                if(symboltable_class.kind_of(id1) == kind::static_k)
-                {
-                    seg = segments::STATIC;
-                }
-                else if(symboltable_class.kind_of(id1) == kind::field_k)
-                {
-                    seg = segments::THIS;
-                }
-                vm_wr.write_push(seg,symboltable_class.index_of(id1));
-            }
-            else if(symboltable_subroutine.symbol_exists_of(id1))
+            variable_ref base = resolve(id1);
+            bool found_base = base.found;
+            segments base_seg = base.seg;
+            int base_index = base.index;
+            array_index ix = classify_array_index();
+            size_t index_code = vm_wr.mark();
+            if(found_base && !ix.known)
             {
-                segments seg;
-                if(symboltable_subroutine.kind_of(id1) == kind::var_k)
-                {
-                    seg = segments::LOCAL;
-                }
-                else if(symboltable_subroutine.kind_of(id1) == kind::arg_k)
-                {
-                    seg = segments::ARG;
-                }
-                vm_wr.write_push(seg,symboltable_subroutine.index_of(id1));
+                vm_wr.write_push(base_seg,base_index);
             }
             xs.enter_tag("symbol", "[", tab_count);
             jt.advance();
             xs.enter_tag("expression", tab_count);
             increment_tab_count();
+            cse_suspended += found_base && ix.known;
             compile_expression();
+            cse_suspended -= found_base && ix.known;
             decrement_tab_count();
             xs.enter_tag("/expression", tab_count);
-            vm_wr.write_arithmetic(command::ADD);
-            vm_wr.write_pop(segments::POINTER,1);
-            vm_wr.write_push(segments::THAT,0);
+            if(found_base && ix.known) // the index code is replaced by a that offset, pointer 1 is only set if it changed
+            {
+                vm_wr.rollback(index_code);
+                if(!vm_wr.that_address_is(array_address(base_seg, base_index, ix)))
+                {
+                    write_array_address(base_seg, base_index, ix);
+                }
+                vm_wr.write_push(segments::THAT,ix.offset);
+            }
+            else
+            {
+                vm_wr.write_arithmetic(command::ADD);
+                vm_wr.write_pop(segments::POINTER,1);
+                vm_wr.write_push(segments::THAT,0);
+            }
             if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == ']')
             {
                 xs.enter_tag("symbol", "]", tab_count);
@@ -1266,10 +1765,11 @@ void compilation_engine::compile_term()
             jt.advance();
             if (jt.return_token_type() == token_type::IDENTIFIER)
             {
-                bool val = symboltable_subroutine.symbol_exists_of(id1);
+                variable_ref var = resolve(id1);
+                bool val = var.found && (var.seg == segments::LOCAL || var.seg == segments::ARG); //a subroutine variable, pushed as local whatever its kind
                 if(val)
                 {
-                    vm_wr.write_push(segments::LOCAL,symboltable_subroutine.index_of(id1));
+                    vm_wr.write_push(segments::LOCAL,var.index);
                 }
                 id2 = jt.return_identifier_string_const();
                 xs.enter_tag("identifier", jt.return_identifier_string_const(), tab_count);
@@ -1284,35 +1784,13 @@ void compilation_engine::compile_term()
                     decrement_tab_count();
                     xs.enter_tag("/expressionList", tab_count);
 
-                    if(symboltable_class.symbol_exists_of(id1))
-                    {
-                        segments seg;
-                        if(symboltable_class.kind_of(id1) == kind::static_k)
-                        {
-                            seg = segments::STATIC;
-                        }
-                        else if(symboltable_class.kind_of(id1) == kind::field_k)
-                        {
-                            seg = segments::THIS;
-                        }
-                        vm_wr.write_push(seg,symboltable_class.index_of(id1));
-                        vm_wr.write_call(symboltable_class.type_of(id1) + "." + id2,num);
-                    }
-                    else if(symboltable_subroutine.symbol_exists_of(id1))
+                    check_call(var.found ? *var.type : id1, id2, num, var.found ? call_form::object_call : call_form::class_call);
+                    if(var.found)
                     {
-                        segments seg;
-                        if(symboltable_subroutine.kind_of(id1) == kind::var_k)
-                        {
-                            seg = segments::LOCAL;
-                        }
-                        else if(symboltable_subroutine.kind_of(id1) == kind::arg_k)
-                        {
-                            seg = segments::ARG;
-                        }
-                        vm_wr.write_push(seg,symboltable_subroutine.index_of(id1));
-                        vm_wr.write_call(symboltable_subroutine.type_of(id1) + "." + id2,num);
+                        vm_wr.write_push(var.seg,var.index);
+                        vm_wr.write_call(*var.type + "." + id2,num);
                     }
-                    else
+                    else if(!compile_intrinsic(id1, id2, num, false))
                     {
                         vm_wr.write_call(id1 + "." + id2 , num);
                     }
@@ -1354,6 +1832,7 @@ void compilation_engine::compile_term()
             num_of_arg = compile_expression_list();
             decrement_tab_count();
             xs.enter_tag("/expressionList", tab_count);
+            check_call(class_name, id1, num_of_arg, call_form::bare_call);
             if (jt.return_token_type() == token_type::SYMBOL && jt.return_symbol() == ')')
             {
                 xs.enter_tag("symbol", ")", tab_count);
@@ -1368,59 +1847,31 @@ void compilation_engine::compile_term()
         }
         else
         {
-            if(symboltable_class.symbol_exists_of(id1))
+            variable_ref var = resolve(id1);
+            if(var.found)
             {
-                segments seg;
-                if(symboltable_class.kind_of(id1) == kind::static_k)
-                {
-                    seg = segments::STATIC;
-                }
-                else if(symboltable_class.kind_of(id1) == kind::field_k)
-                {
-                    seg = segments::THIS;
-                }
-                vm_wr.write_push(seg,symboltable_class.index_of(id1));
-            }
-            else if(symboltable_subroutine.symbol_exists_of(id1))
-            {
-                segments seg;
-                if(symboltable_subroutine.kind_of(id1) == kind::var_k)
-                {
-                    seg = segments::LOCAL;
-                }
-                else if(symboltable_subroutine.kind_of(id1) == kind::arg_k)
-                {
-                    seg = segments::ARG;
-                }
-                vm_wr.write_push(seg,symboltable_subroutine.index_of(id1));
+                vm_wr.write_push(var.seg,var.index);
             }
 
         }
     }
     else if (jt.return_token_type() == token_type::SYMBOL)
     {
-        switch (jt.return_symbol())
+        char op = jt.return_symbol();
+        if (operators.unary[(unsigned char)op] >= 0) // unary - and ~
         {
-        case '-': // unary - oeprator
-            jt.advance();
-            xs.enter_tag("symbol", "-", tab_count);
-            xs.enter_tag("term", tab_count);
-            increment_tab_count();
-            compile_term();
-            decrement_tab_count();
-            xs.enter_tag("/term", tab_count);
-            vm_wr.write_arithmetic(command::NEG);
-            break;
-        case '~': // unary not operator
             jt.advance();
-            xs.enter_tag("symbol", "~", tab_count);
+            xs.enter_tag("symbol", tokenizer::xml_symbol(op), tab_count);
             xs.enter_tag("term", tab_count);
             increment_tab_count();
             compile_term();
             decrement_tab_count();
             xs.enter_tag("/term", tab_count);
-            vm_wr.write_arithmetic(command::NOT);
-            break;
+            vm_wr.write_arithmetic(static_cast<command>(operators.unary[(unsigned char)op]));
+            return;
+        }
+        switch (op)
+        {
         case '(': // '(' expression ')'
             jt.advance();
             xs.enter_tag("symbol", "(", tab_count);
@@ -1480,3 +1931,353 @@ int compilation_engine::compile_expression_list()
         }
     }
 }
+
+variable_ref compilation_engine::resolve(const std::string& name) //one lookup per scope, the class scope is searched first
+{
+    symbol_ref sym = symboltable_class.resolve(name);
+    if(!sym.found)
+    {
+        sym = symboltable_subroutine.resolve(name);
+    }
+    variable_ref var;
+    if(sym.found)
+    {
+        var.found = true;
+        var.seg = kind_segment[sym.ki];
+        var.index = sym.num;
+        var.type = sym.type;
+    }
+    return var;
+}
+
+// looks ahead from the current [ for the index shapes c, v and v + c without consuming any token
+array_index compilation_engine::classify_array_index()
+{
+    array_index ix;
+    const tokenizer::token* t1 = jt.peek_token(1);
+    const tokenizer::token* t2 = jt.peek_token(2);
+    if(t1 == nullptr || t2 == nullptr)
+    {
+        return ix;
+    }
+    if(t1->type == token_type::INT_CONST && t2->type == token_type::SYMBOL && t2->token_name == "]")
+    {
+        ix.known = true;
+        ix.offset = std::stoi(t1->token_name);
+    }
+    else if(variable_ref var = t1->type == token_type::IDENTIFIER ? resolve(t1->token_name) : variable_ref{}; var.found)
+    {
+        ix.var_seg = var.seg;
+        ix.var_index = var.index;
+        const tokenizer::token* t3 = jt.peek_token(3);
+        const tokenizer::token* t4 = jt.peek_token(4);
+        if(t2->type == token_type::SYMBOL && t2->token_name == "]")
+        {
+            ix.known = true;
+        }
+        else if(t2->type == token_type::SYMBOL && t2->token_name == "+" && t3 != nullptr && t4 != nullptr &&
+                t3->type == token_type::INT_CONST && t4->type == token_type::SYMBOL && t4->token_name == "]")
+        {
+            ix.known = true;
+            ix.offset = std::stoi(t3->token_name);
+        }
+    }
+    return ix;
+}
+
+std::vector<std::string> compilation_engine::array_address(segments base_seg, int base_index, const array_index& ix) //the that_address parts of base + variable
+{
+    std::vector<std::string> parts{std::string(segments_string[base_seg]) + " " + std::to_string(base_index)};
+    if(ix.var_index != -1)
+    {
+        parts.push_back(std::string(segments_string[ix.var_seg]) + " " + std::to_string(ix.var_index));
+    }
+    return parts;
+}
+
+void compilation_engine::write_array_address(segments base_seg, int base_index, const array_index& ix) //points that at base + variable, the constant part stays in the that offset
+{
+    vm_wr.write_push(base_seg,base_index);
+    if(ix.var_index != -1)
+    {
+        vm_wr.write_push(ix.var_seg,ix.var_index);
+        vm_wr.write_arithmetic(command::ADD);
+    }
+    vm_wr.write_pop(segments::POINTER,1);
+    vm_wr.set_that_address(array_address(base_seg, base_index, ix));
+}
+
+// the text of a subexpression as it would be without elimination: slot stores are dropped and slot pushes are expanded.
+// Returns "" when the code is not pure, i.e. when it has anything besides pushes, arithmetic and array reads
+std::string compilation_engine::cse_canonical(const std::string& text)
+{
+    std::string canonical;
+    std::istringstream lines(text);
+    std::string line;
+    while(std::getline(lines, line))
+    {
+        if(line.rfind("push local ",0) == 0 && licm.text_of.find(std::stoi(line.substr(11))) != licm.text_of.end())
+        {
+            canonical.append(licm.text_of[std::stoi(line.substr(11))]);
+        }
+        else if(line.rfind("push temp ",0) == 0 && std::stoi(line.substr(10)) >= 2)
+        {
+            canonical.append(cse.slot_text[std::stoi(line.substr(10))]);
+        }
+        else if(line.rfind("pop temp ",0) == 0 && std::stoi(line.substr(9)) >= 2)
+        {
+            std::getline(lines, line); //the push of the same slot that follows every slot store
+        }
+        else if(line.rfind("push ",0) == 0 || line == "pop pointer 1" || line == "call Math.multiply 2" || line == "call Math.divide 2" ||
+                line == "add" || line == "sub" || line == "neg" || line == "eq" || line == "gt" || line == "lt" ||
+                line == "and" || line == "or" || line == "not")
+        {
+            canonical.append(line + "\n");
+        }
+        else
+        {
+            return "";
+        }
+    }
+    return canonical;
+}
+
+// called when a term or an expression prefix starting at start has been written
+void compilation_engine::cse_subexpression(size_t start, const std::vector<std::string>& that_at_start)
+{
+    if(cse_suspended > 0 || expression_depth == 0 || vm_wr.mark() - start > cse_max_code) //deep nesting would canonicalize ever longer code at every level
+    {
+        return;
+    }
+    std::string canonical = cse_canonical(vm_wr.text_from(start));
+    if(canonical == "")
+    {
+        return;
+    }
+    if(licm.local_of.find(canonical) != licm.local_of.end()) //computed before the loop
+    {
+        while(!licm.candidates.empty() && std::get<0>(licm.candidates.back()) >= start) //their code is dropped with it
+        {
+            licm.candidates.pop_back();
+        }
+        vm_wr.rollback(start);
+        vm_wr.write_push(segments::LOCAL,licm.local_of[canonical]);
+        vm_wr.set_that_address(that_at_start);
+        return;
+    }
+    int instructions = std::count(canonical.begin(), canonical.end(), '\n');
+    if(licm.dry_run && (instructions >= 3 || canonical.find("call") != std::string::npos))
+    {
+        licm.candidates.push_back({start, vm_wr.mark(), canonical});
+    }
+    if(instructions < 4 && canonical.find("call") == std::string::npos) //too cheap to be worth a temp slot
+    {
+        return;
+    }
+    std::string key = canonical + "#" + std::to_string(vm_wr.return_side_effects());
+    size_t first_read = canonical.find("push that "), first_set = canonical.find("pop pointer 1");
+    if(first_read != std::string::npos && first_read < first_set) //reads that through a pointer 1 set before it, whose address is part of the value
+    {
+        if(that_at_start.empty())
+        {
+            return;
+        }
+        for(const std::string& part : that_at_start)
+        {
+            key.append("@" + part);
+        }
+    }
+    if(!cse.seen.empty() && cse.seen.back().first == start && cse.seen.back().second == key) //( expression ) has the same code as the expression
+    {
+        return;
+    }
+    cse.seen.push_back({start, key});
+    if(!cse.reusing)
+    {
+        cse.count[key] += 1;
+        return;
+    }
+    if(cse.count[key] < 2)
+    {
+        return;
+    }
+    if(cse.slot_of.find(key) != cse.slot_of.end())
+    {
+        while(!licm.candidates.empty() && std::get<0>(licm.candidates.back()) >= start)
+        {
+            licm.candidates.pop_back();
+        }
+        vm_wr.rollback(start);
+        vm_wr.write_push(segments::TEMP,cse.slot_of[key]);
+        vm_wr.set_that_address(that_at_start); //the dropped copy may have moved pointer 1
+    }
+    else if(cse.next_slot < 8)
+    {
+        int slot = cse.next_slot++;
+        cse.slot_of[key] = slot;
+        cse.slot_text[slot] = canonical;
+        vm_wr.write_pop(segments::TEMP,slot);
+        vm_wr.write_push(segments::TEMP,slot);
+    }
+}
+
+loop_effects compilation_engine::scan_loop(const std::string& loop_code) //read once, every candidate of the loop is checked against it
+{
+    loop_effects loop;
+    std::istringstream loop_lines(loop_code);
+    std::string line;
+    while(std::getline(loop_lines, line))
+    {
+        if(line.rfind("call ",0) == 0 && line != "call Math.multiply 2" && line != "call Math.divide 2")
+        {
+            loop.calls = true;
+        }
+        else if(line.rfind("pop that ",0) == 0 || line.rfind("pop this ",0) == 0)
+        {
+            loop.stores = true;
+        }
+        if(line.rfind("pop local ",0) == 0 || line.rfind("pop argument ",0) == 0 || line.rfind("pop static ",0) == 0 || line.rfind("pop this ",0) == 0)
+        {
+            loop.assigned.insert(line.substr(4));
+        }
+    }
+    return loop;
+}
+
+// a subexpression is invariant when nothing it reads can change inside the loop. Variables are checked against the pops in the
+// loop's own code, so the segment and index the symbol tables gave them decide aliasing. Memory reads need a loop without
+// stores or calls, and divisions are never hoisted since the loop body might not run at all
+bool compilation_engine::licm_invariant(const std::string& canonical, const loop_effects& loop)
+{
+    bool pointer_set = false;
+    std::string line;
+    std::istringstream lines(canonical);
+    while(std::getline(lines, line))
+    {
+        if(line.rfind("push ",0) == 0 && loop.assigned.count(line.substr(5)) > 0)
+        {
+            return false;
+        }
+        if(line == "call Math.divide 2" || line == "push pointer 1" || line.rfind("push temp ",0) == 0 ||
+           ((line.rfind("push static ",0) == 0 || line.rfind("push this ",0) == 0) && loop.calls) ||
+           ((line == "pop pointer 1" || line.rfind("push this ",0) == 0) && (loop.calls || loop.stores)) ||
+           (line.rfind("push that ",0) == 0 && !pointer_set)) //that must be pointed inside the subexpression itself
+        {
+            return false;
+        }
+        if(line == "pop pointer 1")
+        {
+            pointer_set = true;
+        }
+    }
+    return true;
+}
+
+// checks a call against the signature index, which has the classes among the sources but not the os or other libraries
+void compilation_engine::check_call(const std::string& class_nm, const std::string& subroutine_nm, int num_of_args, call_form form)
+{
+    if(signatures == nullptr)
+    {
+        return;
+    }
+    used_signatures.insert(class_nm + "." + subroutine_nm);
+    const class_signature* cls = signatures->find_class(class_nm);
+    if(cls == nullptr)
+    {
+        return;
+    }
+    const subroutine_signature* sub = cls->find(subroutine_nm);
+    if(sub == nullptr)
+    {
+        error(class_nm + "." + subroutine_nm + " is not declared, line: ", jt.return_linenum());
+    }
+    else if(form == call_form::object_call && sub->kind != subroutine_type::method)
+    {
+        error(class_nm + "." + subroutine_nm + " is not a method, line: ", jt.return_linenum());
+    }
+    else if(form == call_form::class_call && sub->kind == subroutine_type::method)
+    {
+        error(class_nm + "." + subroutine_nm + " is a method, line: ", jt.return_linenum());
+    }
+    else if(sub->parameters != num_of_args)
+    {
+        error(class_nm + "." + subroutine_nm + " takes " + std::to_string(sub->parameters) + " arguments, line: ", jt.return_linenum());
+    }
+}
+
+// Memory.peek/poke and Math.abs/min/max are small enough to be written inline instead of going through an os call.
+// The arguments are already on the stack when this is called. Returns false if the call is not an intrinsic so the
+// caller emits the normal call. When discard_result is set (do statements) nothing is left on the stack.
+bool compilation_engine::compile_intrinsic(const std::string& class_nm, const std::string& subroutine_nm, int num_of_args, bool discard_result)
+{
+    if(!options.inline_intrinsics)
+    {
+        return false;
+    }
+
+    if(class_nm == "Memory" && subroutine_nm == "poke" && num_of_args == 2)
+    {
+        vm_wr.write_pop(segments::TEMP,0);
+        vm_wr.write_pop(segments::POINTER,1);
+        vm_wr.write_push(segments::TEMP,0);
+        vm_wr.write_pop(segments::THAT,0);
+        if(!discard_result)
+        {
+            vm_wr.write_push(segments::CONST,0); //poke is void so it returns 0 like every other void call
+        }
+        return true;
+    }
+
+    bool pure = (class_nm == "Memory" && subroutine_nm == "peek" && num_of_args == 1) ||
+                (class_nm == "Math" && subroutine_nm == "abs" && num_of_args == 1) ||
+                (class_nm == "Math" && (subroutine_nm == "min" || subroutine_nm == "max") && num_of_args == 2);
+    if(!pure)
+    {
+        return false;
+    }
+    if(discard_result) //the arguments were evaluated for their side effects, the result is never used
+    {
+        for(int i = 0; i < num_of_args; i++)
+        {
+            vm_wr.write_pop(segments::TEMP,0);
+        }
+        return true;
+    }
+
+    if(subroutine_nm == "peek")
+    {
+        vm_wr.write_pop(segments::POINTER,1);
+        vm_wr.write_push(segments::THAT,0);
+        return true;
+    }
+
+    label_count += 1;
+    std::string end_label = std::string("L") + std::to_string(label_count) + "_intrinsic";
+    if(subroutine_nm == "abs") // x stays on the stack and is negated only when x < 0
+    {
+        vm_wr.write_pop(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,0);
+        vm_wr.write_push(segments::CONST,0);
+        vm_wr.write_arithmetic(command::LT);
+        vm_wr.write_arithmetic(command::NOT);
+        vm_wr.write_if(end_label);
+        vm_wr.write_arithmetic(command::NEG);
+        vm_wr.write_label(end_label);
+    }
+    else // min and max keep a on the stack and replace it with b when b wins the comparison
+    {
+        vm_wr.write_pop(segments::TEMP,1);
+        vm_wr.write_pop(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,1);
+        vm_wr.write_arithmetic(subroutine_nm == "min" ? command::GT : command::LT);
+        vm_wr.write_arithmetic(command::NOT);
+        vm_wr.write_if(end_label);
+        vm_wr.write_pop(segments::TEMP,0);
+        vm_wr.write_push(segments::TEMP,1);
+        vm_wr.write_label(end_label);
+    }
+    return true;
+}
@@ -2,28 +2,40 @@
 #include "jack_tokenizer.h"
 #include "vm_writer.h"
 #include "symbol_table.h"
+#include "compile_options.h"
+#include "profile.h"
+#include "parse_stack.h"
+#include "signature_index.h"
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <set>
+#include <tuple>
 //this is a recursive descent parser
 
 struct xml_string //stores the each tags in the xml 
 {
     std::string xml_string;
+    bool off = false; //tags are dropped, nobody reads the parse tree. deep nesting makes it grow with the square of the depth
     void enter_tag(std::string token_element,std::string token_name,int tabs)
     {
-        for(int i = 0; i < tabs; i++)
+        if(off)
         {
-            xml_string.append("\t");
+            return;
         }
+        xml_string.append(tabs, '\t');
         xml_string.append(std::string("<") + token_element + "> " + token_name + " </" + token_element + ">");
         xml_string.append("\n");
     }
 
     void enter_tag(std::string token_element, int tabs)
     {
-        for(int i = 0; i < tabs; i++)
+        if(off)
         {
-            xml_string.append("\t");
+            return;
         }
+        xml_string.append(tabs, '\t');
         xml_string.append(std::string("<") + token_element + ">");
         xml_string.append("\n");
     }
@@ -34,9 +46,116 @@ struct xml_string //stores the each tags in the xml
     }
 };
 
-enum subroutine_type
+enum call_form //how a call names its subroutine, which decides the kinds of subroutine it may call
 {
-    constructor,function,method
+    bare_call, class_call, object_call
+};
+
+struct variable_ref //a variable as the vm sees it, found is false when neither symbol table has the name
+{
+    bool found = false;
+    segments seg = segments::CONST;
+    int index = 0;
+    const std::string* type = nullptr;
+};
+
+inline const segments kind_segment[] {segments::STATIC, segments::THIS, segments::LOCAL, segments::ARG, segments::CONST}; //indexed by kind
+
+struct operator_table //vm command of each operator symbol, -1 for characters that aren't one
+{
+    signed char binary[256] = {};
+    signed char unary[256] = {};
+};
+
+constexpr operator_table make_operator_table()
+{
+    operator_table t;
+    for(int c = 0; c < 256; c++)
+    {
+        t.binary[c] = -1;
+        t.unary[c] = -1;
+    }
+    t.binary[(unsigned char)'+'] = command::ADD;
+    t.binary[(unsigned char)'-'] = command::SUB;
+    t.binary[(unsigned char)'*'] = command::MUL;
+    t.binary[(unsigned char)'/'] = command::DIV;
+    t.binary[(unsigned char)'&'] = command::AND;
+    t.binary[(unsigned char)'|'] = command::OR;
+    t.binary[(unsigned char)'<'] = command::LT;
+    t.binary[(unsigned char)'>'] = command::GT;
+    t.binary[(unsigned char)'='] = command::EQ;
+    t.unary[(unsigned char)'-'] = command::NEG;
+    t.unary[(unsigned char)'~'] = command::NOT;
+    return t;
+}
+
+inline constexpr operator_table operators = make_operator_table(); //jack has no precedence, operators apply left to right
+
+struct array_index //an index expression that is a constant, a variable or variable + constant, addressed with that offsets
+{
+    bool known = false; //false for any other index expression, those use the general add sequence
+    segments var_seg = segments::CONST;
+    int var_index = -1; //-1 for constant indices
+    int offset = 0;
+};
+
+struct syntax_error //one error found while parsing, thrown by error() and caught where the parser can resume
+{
+    std::string what;
+    int line = 0;
+};
+
+struct parse_checkpoint //engine state at the start of a statement or declaration, put back when it fails to parse
+{
+    int tab_count = 0;
+    int nesting = 0;
+    int expression_depth = 0;
+    int cse_suspended = 0;
+    bool licm_dry_run = false;
+    int licm_live = 0;
+    int licm_depth = 0;
+};
+
+struct compiled_subroutine //output of one subroutine compiled on a worker thread, labels count from L1
+{
+    std::string xml;
+    std::string vm;
+    int labels = 0;
+    std::vector<syntax_error> errors;
+    std::set<std::string> used_signatures;
+    int end_position = 0; //the token after the subroutine
+};
+
+const size_t cse_max_code = 4096; //subexpressions with more vm code than this are neither reused nor hoisted
+
+struct cse_state //common subexpression bookkeeping for one top level expression, keys are canonical vm text + side effect count
+{
+    bool reusing = false; //false on the first pass that only counts, true on the pass that keeps repeated values in temp
+    std::vector<std::pair<size_t,std::string>> seen; //start and key of each recorded subexpression, in order
+    std::unordered_map<std::string,int> count;
+    std::unordered_map<std::string,int> slot_of; //key -> temp slot holding its value
+    std::string slot_text[8]; //canonical text of the value in each slot
+    int next_slot = 2; //temp 0 and 1 are scratch for array stores and intrinsics
+};
+
+struct licm_state //loop invariant code motion for while loops
+{
+    bool dry_run = false; //set while a loop is compiled once to find its invariant subexpressions
+    std::vector<std::tuple<size_t,size_t,std::string>> candidates; //start, end and canonical text of pure subexpressions in the loop
+    std::unordered_map<std::string,int> local_of; //hoisted canonical text -> local holding its value
+    std::unordered_map<int,std::string> text_of; //local -> hoisted canonical text
+    int live = 0; //hoisted locals of the loops being compiled
+    int max = 0; //most hoisted locals live at once in this subroutine
+    int depth = 0; //loops being compiled again with their invariants hoisted
+};
+
+const int licm_max_depth = 3; //loops nested deeper in loops being compiled again aren't analysed, so no code is compiled more than 4 times
+
+struct loop_effects //what the code of a loop writes, scanned once for all its candidates
+{
+    bool calls = false;
+    bool stores = false; //pop that or pop this
+    std::unordered_set<std::string> assigned; //"segment index" of every variable popped
 };
 
 class compilation_engine
@@ -54,20 +173,85 @@ private:
     std::string current_return_type;
     int subroutine_local_variable_count;
     int label_count = 0;
+    compile_options options;
+    cse_state cse;
+    licm_state licm;
+    const profile_data* profile = nullptr; //execution counts from --profile-use, nullptr without one
+    const signature_index* signatures = nullptr; //declarations of all the classes being compiled, calls into them are checked
+    std::set<std::string> used_signatures; //Class.subroutine of every call checked against signatures, the output depends on them
+    int if_ordinal = 0; //if statements seen so far in the current subroutine, the profile's branch key
+    int nesting = 0; //terms and statement blocks being parsed
+    int expression_depth = 0;
+    int cse_suspended = 0; //set while compiling code that is rolled back afterwards
+    std::ostream* token_sink = nullptr; //set when streaming, the outputs are written after every subroutine
+    std::ostream* xml_sink = nullptr;
+    std::ostream* vm_sink = nullptr;
+    int streamed_tokens = 0; //tokens already listed in token_sink
+    std::vector<syntax_error> errors; //in source order, reported together once the class is parsed
     
 
 public:
     compilation_engine() = default;
-    compilation_engine(tokenizer::jack_tokenizer jt_tmp): jt{jt_tmp} {}
+    compilation_engine(tokenizer::jack_tokenizer jt_tmp, compile_options opts = {}): jt{jt_tmp}, options{opts}
+    {
+        xs.off = !opts.parse_tree;
+    }
     void pass_tokenizer(tokenizer::jack_tokenizer jt_tmp) //this will reset the whole engine
     {
         jt = jt_tmp;
         xs.reset();
         tab_count = 0;
     }
+    void use_profile(const profile_data* p)
+    {
+        profile = p;
+    }
+    void use_signatures(const signature_index* index)
+    {
+        signatures = index;
+    }
+    void stream_to(std::ostream* tokens, std::ostream* xml, std::ostream* vm) //can't be used with a profile, inlining needs the whole vm file
+    {
+        token_sink = tokens;
+        xml_sink = xml;
+        vm_sink = vm;
+    }
+    bool compile_collecting_errors() //false when the class has syntax errors, take_errors gives them
+    {
+        if(!run_on_parse_stacks({[this]()
+        {
+            try
+            {
+                compile_class();
+            }
+            catch(const syntax_error& e) //the class header or its closing brace, nothing left to resume
+            {
+                record_error(e);
+            }
+        }}))
+        {
+            record_error(syntax_error{"Not enough memory for a parser stack, line: ", 0});
+        }
+        if(!errors.empty())
+        {
+            return false;
+        }
+        if(profile != nullptr)
+        {
+            vm_wr.inline_marked_calls();
+        }
+        return true;
+    }
     void compile()
     {
-        compile_class();
+        if(!compile_collecting_errors())
+        {
+            for(const syntax_error& e : errors)
+            {
+                std::cerr << "Syntax Error : " + e.what + std::to_string(e.line) << std::endl;
+            }
+            exit(1);
+        }
     }
     
     void print()
@@ -83,33 +267,111 @@ public:
     {
         return vm_wr.return_vm_file();
     }
+
+    const std::set<std::string>& return_used_signatures() const
+    {
+        return used_signatures;
+    }
+
+    //a class_session compiles a class a piece at a time so it can keep the pieces that an edit didn't touch. the
+    //header leaves the engine ready for subroutines, which compile on copies of it like the --jobs workers do
+    bool compile_header(std::string& xml);
+    compiled_subroutine compile_subroutine_from(const tokenizer::jack_tokenizer& tokens, int position);
+    std::string compile_footer(const tokenizer::jack_tokenizer& tokens, int position);
+    int return_token_position() const
+    {
+        return jt.return_token_position();
+    }
+    std::vector<syntax_error> take_errors()
+    {
+        return std::move(errors);
+    }
+
+    std::string take_parse_string() //the parse tree of deeply nested code is large, this one isn't copied
+    {
+        return std::move(xs.xml_string);
+    }
     
 
 private:
-    void error(std::string what, int line_num) //reports error
+    void error(std::string what, int line_num) //unwinds to the statement or declaration being parsed, which records it and skips ahead
     {
-        std::cout << xs.xml_string << std::endl;
-        std::cout << jt.return_token_type() << std::endl;
-        std::cerr << "Syntax Error : " + what + std::to_string(line_num)  << std::endl;
-        exit(1);
+        throw syntax_error{what, line_num};
+    }
+
+    void record_error(const syntax_error& e) //loops analysed for invariants are parsed twice, their errors are kept once
+    {
+        for(const syntax_error& seen : errors)
+        {
+            if(seen.line == e.line && seen.what == e.what)
+            {
+                return;
+            }
+        }
+        errors.push_back(e);
     }
 
     void compile_class();
+    void compile_class_header();
+    void compile_class_footer();
     void compile_class_var_dec();
     void compile_subroutine();
+    void compile_subroutine_dec();
+    bool compile_subroutines_parallel();
+    void stream_out(bool at_end);
+    int find_subroutine_starts(std::vector<int>& starts);
     void compile_subroutine_body();
     void compile_parameter_list();
     void compile_var_dec();
     void compile_statements();
+    void compile_statement_list();
     void compile_do();
     void compile_let();
     void compile_while();
+    void compile_while_body();
     void compile_return();
     void compile_if();
     void compile_expression();
+    void compile_expression_body();
     void compile_term();
+    void compile_term_body();
     int compile_expression_list();
-    void compile_else(int);
+    void compile_else();
+    parse_checkpoint checkpoint() const;
+    void recover(const parse_checkpoint& cp, const syntax_error& e);
+    void skip_statement(int start);
+    void skip_declaration(int start, bool class_var);
+    void skip_block();
+    bool then_is_cold(int ordinal);
+    void mark_hot_call_sites();
+    variable_ref resolve(const std::string& name);
+    array_index classify_array_index();
+    std::vector<std::string> array_address(segments base_seg, int base_index, const array_index& ix);
+    void write_array_address(segments base_seg, int base_index, const array_index& ix);
+    std::string cse_canonical(const std::string& text);
+    loop_effects scan_loop(const std::string& loop_code);
+    bool licm_invariant(const std::string& canonical, const loop_effects& loop);
+    void cse_subexpression(size_t start, const std::vector<std::string>& that_at_start);
+    void check_call(const std::string& class_nm, const std::string& subroutine_nm, int num_of_args, call_form form);
+    bool compile_intrinsic(const std::string& class_nm, const std::string& subroutine_nm, int num_of_args, bool discard_result);
+
+    template<typename body_t>
+    void nested(body_t body) //a term or statement block one level deeper, every parse_stack_levels levels goes on a fresh stack
+    {
+        if(++nesting > options.max_nesting && options.max_nesting > 0)
+        {
+            error("Nesting too deep, line: ", jt.return_linenum());
+        }
+        if(nesting % parse_stack_levels != 0)
+        {
+            body();
+        }
+        else if(!run_on_parse_stacks({body}))
+        {
+            error("Not enough memory for nesting this deep, line: ", jt.return_linenum());
+        }
+        nesting -= 1;
+    }
 
     void increment_tab_count()
     {
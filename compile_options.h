@@ -0,0 +1,22 @@
+#pragma once
+#include <string>
+
+//options that change how the compiler generates code, filled from the command line in main
+struct compile_options
+{
+    bool inline_intrinsics = false; //lowers Memory.peek/poke and Math.abs/min/max into inline vm code instead of os calls
+    std::string profile_generate; //runs the compiled program and writes its execution counts to this file
+    std::string profile_use; //execution counts used to inline hot calls and move rarely taken if blocks out of line
+    bool pipeline = false; //lexes on a thread of its own while the parser takes the tokens lexed so far
+    bool stream = false; //writes the outputs a subroutine at a time so memory does not grow with the file, can't be used with profile_use
+    int jobs = 1; //threads compiling the subroutines of a class, 1 compiles them in order on the calling thread
+    int workers = 0; //processes compiling the files of a directory, a file that fails only stops its own worker. 0 compiles in this process
+    bool rebuild = false; //compiles every file, even those whose outputs are up to date
+    bool watch = false; //keeps running and compiles again whenever a source changes, each class a subroutine at a time on one thread
+    std::string emit = "vm"; //what compiling - writes to stdout: vm, xml or tokens
+    bool framed = false; //- reads and writes many classes, each in a frame of its own
+    bool lsp = false; //serves the language server protocol on stdin and stdout instead of compiling
+    bool parse_tree = true; //builds the parse tree xml, compiling - only builds it when it emits it
+    int max_nesting = 0; //deepest nesting of blocks and terms the parser accepts, 0 accepts any the memory allows
+    bool trace = true; //the parser prints return types and symbols on stdout as it goes, the library turns it off
+};
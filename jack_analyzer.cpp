@@ -2,75 +2,38 @@
 #include <filesystem>
 #include "jack_analyzer.h"
 #include "regex_utils.h"
+#include "vm_interpreter.h"
+#include "char_scan.h"
+#include "async_io.h"
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <csignal>
+#include <chrono>
+#include <sstream>
+#include <sys/inotify.h>
 
 
 
 namespace fs = std::filesystem;
 using jack_tokenizer = tokenizer::jack_tokenizer;
 
-jack_analyzer::jack_analyzer(std::string name)
+jack_analyzer::jack_analyzer(std::string name, compile_options opts) : options{opts}
 {
     file_or_not = regex_utils::check_regex_str_exist(name,std::regex("\\.jack$"),".jack",0); //returns if the the name have .jack extension or not if it doesn't its a directory
     
     if(file_or_not)
     {
-        file_name.push_back(name);
-        
-        for(int i = 0,length = name.length(); i < length; i++)
-        {
-            tokenizer_file_names.push_back("");
-            parser_file_names.push_back("");
-            vm_file_names.push_back("");
-            if(!(name[i]=='.' && name[i+1] == 'j' && name[i+2] == 'a' && name[i+3] == 'c' && name[i+4] == 'k'))
-            {
-                tokenizer_file_names[0].push_back(name[i]);
-                parser_file_names[0].push_back(name[i]);
-                vm_file_names[0].push_back(name[i]);
-                vm_file_name.push_back(name[i]);
-            }
-            else
-            {
-                break;
-            }
-            
-        }
-        tokenizer_file_names[0].append("T.xml");
-        parser_file_names[0].append(".xml");
-        vm_file_names[0].append(".vm");
-        vm_file_name.append(".vm");
+        add_source(name);
+        vm_file_name = vm_file_names[0];
+        directory = fs::path(name).parent_path().string();
     }
     else
     {
         vm_file_name = name + "/" +name + ".vm";
-        for (const auto & entry : fs::directory_iterator(name))
-        {
-            if(regex_utils::check_regex_str_exist(entry.path(),std::regex("(\\.jack$)"),".jack",0))
-            {
-                file_name.push_back(entry.path());
-                std::string fname = entry.path();
-                int current_str = file_name.size() - 1;
-                tokenizer_file_names.push_back("");
-                parser_file_names.push_back("");
-                vm_file_names.push_back("");
-                for(int i = 0,length = file_name[current_str].length(); i < length; i++)
-                {
-                    
-                    if(!(fname[i]=='.' && fname[i+1] == 'j' && fname[i+2] == 'a' && fname[i+3] == 'c' && fname[i+4] == 'k'))
-                    {
-                        tokenizer_file_names[current_str].append(std::string{fname[i]});
-                        parser_file_names[current_str].append(std::string{fname[i]});
-                        vm_file_names[current_str].append(std::string{fname[i]});
-                    }
-                    else
-                    {
-                        break;
-                    }
-                }
-                tokenizer_file_names[current_str].append("T.xml");
-                parser_file_names[current_str].append(".xml");
-                vm_file_names[current_str].append(".vm");
-            }
-        }
+        directory = name;
+        find_sources();
     }
     for(int i = 0; i < file_name.size();i++)
     {
@@ -81,65 +44,487 @@ jack_analyzer::jack_analyzer(std::string name)
     
 }
 
+void jack_analyzer::add_source(const std::string& path) //Main.jack -> MainT.xml, Main.xml and Main.vm
+{
+    std::string stem = path.substr(0, path.find(".jack"));
+    file_name.push_back(path);
+    tokenizer_file_names.push_back(stem + "T.xml");
+    parser_file_names.push_back(stem + ".xml");
+    vm_file_names.push_back(stem + ".vm");
+}
+
+void jack_analyzer::find_sources() //every .jack file in the directory
+{
+    file_name.clear();
+    tokenizer_file_names.clear();
+    parser_file_names.clear();
+    vm_file_names.clear();
+    for (const auto & entry : fs::directory_iterator(directory))
+    {
+        if(regex_utils::check_regex_str_exist(entry.path(),std::regex("(\\.jack$)"),".jack",0))
+        {
+            add_source(entry.path());
+        }
+    }
+}
+
 void jack_analyzer::analyze()
 {
-    for(int i = 0; i < file_name.size();i++)
+    if(options.profile_use != "" && !profile.load(options.profile_use))
     {
-        jack_tokenizer jt{file_name[i]};
-        std::cout << file_name[i] << std::endl;
-        token_filehandle.open(tokenizer_file_names[i]);
-        parser_filehandle.open(parser_file_names[i]);
-        vm_handle.open(vm_file_names[i]);
-        std::string tokenizer_string{""};
-        tokenizer_string.append("<token>\n");
-        while(jt.has_more_token())
-        {  
-            if(jt.return_token_type() == tokenizer::token_type::KEYWORD)
+        std::cerr << "Can't read profile " << options.profile_use << std::endl;
+        exit(1);
+    }
+    auto started = std::chrono::steady_clock::now();
+    signatures.build(file_name, (directory == "" ? std::string(".") : directory) + "/.jack_signatures");
+    for(size_t i = 0; i < file_name.size();i++)
+    {
+        if(!up_to_date(i))
+        {
+            stale_files.push_back(i);
+        }
+    }
+    if(options.workers > 0)
+    {
+        compile_in_workers();
+    }
+    else if(options.stream)
+    {
+        for(int i : stale_files)
+        {
+            compile_streaming(i);
+        }
+    }
+    else
+    {
+        std::vector<std::string> stale_names;
+        for(int i : stale_files)
+        {
+            stale_names.push_back(file_name[i]);
+        }
+        source_prefetcher sources{stale_names, read_ahead};
+        output_writer writer;
+        for(int i : stale_files)
+        {
+            compile_file(i, jack_tokenizer{sources.take(), options.jobs, options.pipeline}, writer);
+        }
+        writer.finish(); //the profiling run reads the .vm files back
+    }
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Compiled " << stale_files.size() << " of " << file_name.size() << " files, " << file_name.size() - stale_files.size() << " up to date, " << ms << " ms" << std::endl;
+    if(options.profile_generate != "")
+    {
+        generate_profile();
+    }
+}
+
+void jack_analyzer::compile_file(int i, jack_tokenizer jt, output_writer& writer)
+{
+    std::cout << file_name[i] << std::endl;
+    std::string tokens;
+    if(!options.pipeline) //with the pipeline listing the tokens first would wait for the whole file to be lexed
+    {
+        tokens = token_dump(jt);
+    }
+    compilation_engine engine{jt, options};
+    if(options.profile_use != "")
+    {
+        engine.use_profile(&profile);
+    }
+    engine.use_signatures(&signatures);
+    engine.compile();
+    if(options.pipeline)
+    {
+        tokens = token_dump(jt);
+    }
+    writer.write(tokenizer_file_names[i], std::move(tokens));
+    writer.write(parser_file_names[i], engine.return_parse_string());
+    writer.write(vm_file_names[i], engine.return_vm_file());
+    writer.write(dependency_file(i), dependency_record(i, engine.return_used_signatures())); //last, so a file whose outputs aren't all written is compiled again
+}
+
+// every worker is a forked process with a pipe from the parent carrying the index of its next file and a pipe back
+// carrying the index once the file is written. a worker that exits on a syntax error closes its pipe back without an
+// answer, the parent reports that file, starts a new worker in its place and the rest of the files go on
+void jack_analyzer::compile_in_workers()
+{
+    struct worker
+    {
+        pid_t pid = -1;
+        int to_worker = -1;
+        int from_worker = -1;
+        int file = -1; //file being compiled, -1 when idle
+    };
+    std::vector<worker> workers(std::min<int>(options.workers, stale_files.size()));
+    std::vector<int> failed;
+    int next_file = 0;
+    signal(SIGPIPE, SIG_IGN); //a worker that died shows up as the end of its pipe, not as a signal
+
+    auto start_worker = [this, &workers](worker& w)
+    {
+        int to[2], from[2];
+        if(pipe(to) != 0 || pipe(from) != 0)
+        {
+            std::cerr << "Can't create worker pipes" << std::endl;
+            exit(1);
+        }
+        std::cout.flush();
+        pid_t pid = fork();
+        if(pid < 0)
+        {
+            std::cerr << "Can't start a worker" << std::endl;
+            exit(1);
+        }
+        if(pid == 0)
+        {
+            for(const worker& other : workers) //only the parent may hold the other workers' pipes, or they never see the end
             {
-                tokenizer_string.append(std::string("\t<keyword>") + tokenizer::KEYWORDS[jt.return_keyword_type()]+"</keyword>\n");
+                if(other.to_worker != -1) close(other.to_worker);
+                if(other.from_worker != -1) close(other.from_worker);
             }
+            close(to[1]);
+            close(from[0]);
+            run_worker(to[0], from[1]);
+            _exit(0);
+        }
+        close(to[0]);
+        close(from[1]);
+        w = worker{pid, to[1], from[0], -1};
+    };
+    auto give_file = [this, &next_file](worker& w)
+    {
+        if(next_file < (int)stale_files.size())
+        {
+            w.file = stale_files[next_file++];
+            if(write(w.to_worker, &w.file, sizeof(w.file)) != sizeof(w.file))
+            {
+                std::cerr << "Can't reach worker " << w.pid << std::endl;
+            }
+        }
+    };
 
-            else if(jt.return_token_type() == tokenizer::token_type::INT_CONST)
+    for(worker& w : workers)
+    {
+        start_worker(w);
+        give_file(w);
+    }
+    while(true)
+    {
+        std::vector<pollfd> busy;
+        for(const worker& w : workers)
+        {
+            if(w.file != -1)
+            {
+                busy.push_back(pollfd{w.from_worker, POLLIN, 0});
+            }
+        }
+        if(busy.empty())
+        {
+            break;
+        }
+        if(poll(busy.data(), busy.size(), -1) < 0)
+        {
+            continue;
+        }
+        for(const pollfd& p : busy)
+        {
+            if(p.revents == 0)
+            {
+                continue;
+            }
+            worker& w = *std::find_if(workers.begin(), workers.end(), [&p](const worker& w){ return w.from_worker == p.fd; });
+            int done = -1;
+            if(read(w.from_worker, &done, sizeof(done)) == sizeof(done))
             {
-                tokenizer_string.append(std::string("\t<integerConstant>") + std::to_string(jt.return_integer()) +"</integerConstant>\n");
+                w.file = -1;
+                give_file(w);
+                continue;
             }
+            int status = 0;
+            close(w.to_worker);
+            close(w.from_worker);
+            waitpid(w.pid, &status, 0);
+            std::cerr << "Compiling " << file_name[w.file] << " failed, worker exited with status " << (WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) << std::endl;
+            failed.push_back(w.file);
+            w = worker{};
+            if(next_file < (int)stale_files.size())
+            {
+                start_worker(w);
+                give_file(w);
+            }
+        }
+    }
+    for(worker& w : workers)
+    {
+        if(w.pid != -1)
+        {
+            close(w.to_worker); //a worker exits when its pipe ends
+            close(w.from_worker);
+            waitpid(w.pid, nullptr, 0);
+        }
+    }
+    if(!failed.empty())
+    {
+        std::cerr << failed.size() << " of " << stale_files.size() << " files failed" << std::endl;
+        exit(1);
+    }
+}
 
-            else if(jt.return_token_type() == tokenizer::token_type::IDENTIFIER)
+void jack_analyzer::run_worker(int from_parent, int to_parent)
+{
+    int i;
+    while(read(from_parent, &i, sizeof(i)) == sizeof(i))
+    {
+        if(options.stream)
+        {
+            compile_streaming(i);
+        }
+        else
+        {
+            output_writer writer;
+            compile_file(i, jack_tokenizer{file_name[i], options.jobs, options.pipeline}, writer);
+            writer.finish();
+        }
+        std::cout.flush();
+        if(write(to_parent, &i, sizeof(i)) != sizeof(i))
+        {
+            return;
+        }
+    }
+}
+
+void jack_analyzer::compile_streaming(int i) //the outputs are written a subroutine at a time, so memory stays flat however long the file is
+{
+    jack_tokenizer jt{file_name[i], 1, true, true};
+    std::cout << file_name[i] << std::endl;
+    std::ofstream tokens(tokenizer_file_names[i]);
+    std::ofstream parse(parser_file_names[i]);
+    std::ofstream vm(vm_file_names[i]);
+    tokens << "<token>\n";
+    compilation_engine engine{jt, options};
+    engine.use_signatures(&signatures);
+    engine.stream_to(&tokens, &parse, &vm);
+    engine.compile();
+    tokens << "</token>\n";
+    std::ofstream(dependency_file(i)) << dependency_record(i, engine.return_used_signatures());
+}
+
+std::string jack_analyzer::token_dump(jack_tokenizer& jt) //the T.xml listing of every token, leaves jt at the first token
+{
+    std::string tokenizer_string{""};
+    tokenizer_string.append("<token>\n");
+    while(jt.has_more_token())
+    {
+        tokenizer_string.append(tokenizer::token_xml(*jt.peek_token(0)));
+        jt.advance();
+    }
+    tokenizer_string.append("</token>\n");
+    jt.reset_token_seeker();
+    return tokenizer_string;
+}
+
+void jack_analyzer::generate_profile() //runs every .vm file next to the sources, os files included when they are there
+{
+    vm_interpreter vm; //what the program prints is dropped, it would only run into the compiler's own output
+    for (const auto & entry : fs::directory_iterator(directory == "" ? "." : directory))
+    {
+        if(entry.path().extension() == ".vm" && !vm.load(entry.path().string()))
+        {
+            std::cerr << "Can't load " << entry.path() << std::endl;
+            return;
+        }
+    }
+    if(!vm.run(100000000))
+    {
+        std::cerr << "Profiling run stopped early, writing the counts so far" << std::endl;
+    }
+    if(!vm.return_profile().save(options.profile_generate))
+    {
+        std::cerr << "Can't write profile " << options.profile_generate << std::endl;
+    }
+    std::cout << "Profiled " << vm.return_steps() << " vm steps" << std::endl;
+}
+
+
+// a file is compiled again unless its .deps record says the outputs came from the same source and options, and every
+// signature its calls were checked against is still declared the same way. a body only edit of one class changes no
+// signature, so only that class is compiled again
+bool jack_analyzer::up_to_date(int i)
+{
+    if(options.rebuild || options.profile_use != "") //the profile can change without any source changing
+    {
+        return false;
+    }
+    std::ifstream in(dependency_file(i));
+    if(!in.is_open() || !fs::exists(tokenizer_file_names[i]) || !fs::exists(parser_file_names[i]) || !fs::exists(vm_file_names[i]))
+    {
+        return false;
+    }
+    bool same_source = false, same_options = false;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string record, value;
+        fields >> record;
+        fields.get();
+        if(record == "source")
+        {
+            uint64_t hash = 0;
+            fields >> hash;
+            same_source = hash == signatures.hash_of(file_name[i]);
+        }
+        else if(record == "options")
+        {
+            std::getline(fields, value);
+            same_options = value == options_key();
+        }
+        else if(record == "uses")
+        {
+            std::string name;
+            fields >> name;
+            fields.get();
+            std::getline(fields, value);
+            size_t dot = name.find('.');
+            if(dot == std::string::npos || signatures.describe(name.substr(0, dot), name.substr(dot + 1)) != value)
             {
-                tokenizer_string.append(std::string("\t<identifier>") + jt.return_identifier_string_const() +"</identifier>\n");
+                return false;
             }
-            else if(jt.return_token_type() == tokenizer::token_type::STRING_CONST)
+        }
+    }
+    return same_source && same_options;
+}
+
+std::string jack_analyzer::dependency_file(int i) //next to the .vm file, Main.vm -> Main.deps
+{
+    return vm_file_names[i].substr(0, vm_file_names[i].size() - 3) + ".deps";
+}
+
+std::string jack_analyzer::dependency_record(int i, const std::set<std::string>& used_signatures)
+{
+    std::string record = "source " + std::to_string(signatures.hash_of(file_name[i])) + "\n" + "options " + options_key() + "\n";
+    for(const std::string& name : used_signatures)
+    {
+        size_t dot = name.find('.');
+        record += "uses " + name + " " + signatures.describe(name.substr(0, dot), name.substr(dot + 1)) + "\n";
+    }
+    return record;
+}
+
+std::string jack_analyzer::options_key() //the options that change what a file compiles to
+{
+    return std::string(options.inline_intrinsics ? "inline-intrinsics" : "plain") + " max-nesting " + std::to_string(options.max_nesting);
+}
+
+
+// --watch compiles what is out of date, then again each time a source in the directory is written, moved or
+// deleted. saves closer together than debounce_ms are taken as one change. the classes stay compiled between
+// rebuilds in their class_session, so an edit compiles only the subroutines it touched
+void jack_analyzer::watch()
+{
+    std::string watched = directory == "" ? "." : directory;
+    int fd = inotify_init1(IN_CLOEXEC);
+    if(fd < 0 || inotify_add_watch(fd, watched.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0)
+    {
+        std::cerr << "Can't watch " << watched << std::endl;
+        exit(1);
+    }
+    rebuild();
+    options.rebuild = false; //only the first build compiles everything
+    std::cout << "Watching " << watched << std::endl;
+    while(true)
+    {
+        if(source_changed(fd, -1))
+        {
+            while(source_changed(fd, debounce_ms))
             {
-                tokenizer_string.append(std::string("\t<stringConstant>") + jt.return_identifier_string_const() +"</stringConstant>\n");
             }
-            else if(jt.return_token_type() == tokenizer::token_type::SYMBOL)
+            rebuild();
+        }
+    }
+}
+
+bool jack_analyzer::source_changed(int fd, int timeout_ms) //waits for an event on a .jack file, at most timeout_ms unless it is -1
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    alignas(inotify_event) char events[16 * 1024];
+    while(true)
+    {
+        int wait = -1;
+        if(timeout_ms >= 0)
+        {
+            wait = std::max<long long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+        }
+        pollfd p{fd, POLLIN, 0};
+        if(poll(&p, 1, wait) <= 0)
+        {
+            return false;
+        }
+        ssize_t n = read(fd, events, sizeof(events));
+        for(ssize_t at = 0; at < n;)
+        {
+            const inotify_event* e = reinterpret_cast<const inotify_event*>(events + at);
+            at += sizeof(inotify_event) + e->len;
+            std::string name = e->len > 0 ? e->name : "";
+            if(file_or_not ? name == fs::path(file_name[0]).filename().string() : fs::path(name).extension() == ".jack")
             {
-                if(jt.return_symbol() == '<')
-                {
-                    tokenizer_string.append(std::string("\t<symbol>")+"&lt;"+"</symbol>\n");
-                }
-                else if(jt.return_symbol() == '>')
-                {
-                    tokenizer_string.append(std::string("\t<symbol>")+"&gt;"+"</symbol>\n");
-                }
-                else
-                {
-                    tokenizer_string.append(std::string("\t<symbol>")+jt.return_symbol()+"</symbol>\n");
-                }
+                return true;
             }
-            jt.advance();
         }
-        tokenizer_string.append("</token>\n");
-        jt.reset_token_seeker();
-        token_filehandle << tokenizer_string;
-        compilation_engine engine{jt};
-        engine.compile();
-        parser_filehandle << engine.return_parse_string();
-        vm_handle << engine.return_vm_file();;
-        parser_filehandle.close();
-        token_filehandle.close();
-        vm_handle.close();
-        
     }
 }
 
+// one build of --watch. the stale files are found the way analyze finds them, each compiles in its class's
+// session and its outputs replace the old ones through renames, .deps last. a class with errors keeps the outputs
+// of its last good build and its .deps, so it stays stale until it compiles
+void jack_analyzer::rebuild()
+{
+    auto started = std::chrono::steady_clock::now();
+    if(!file_or_not)
+    {
+        find_sources();
+    }
+    signatures = signature_index{};
+    signatures.build(file_name, (directory == "" ? std::string(".") : directory) + "/.jack_signatures");
+    int stale = 0, failed = 0, compiled = 0, kept = 0;
+    for(size_t i = 0; i < file_name.size(); i++)
+    {
+        if(up_to_date(i))
+        {
+            continue;
+        }
+        stale++;
+        std::vector<std::string> lines;
+        try
+        {
+            lines = read_source_lines(file_name[i]);
+        }
+        catch(const std::runtime_error& e) //deleted since the directory was listed
+        {
+            std::cerr << e.what() << std::endl;
+            failed++;
+            continue;
+        }
+        class_session& session = sessions.try_emplace(file_name[i], options).first->second;
+        if(!session.compile(lines, &signatures))
+        {
+            for(const syntax_error& e : session.return_errors())
+            {
+                std::cerr << file_name[i] << ": Syntax Error : " + e.what + std::to_string(e.line) << std::endl;
+            }
+            failed++;
+            continue;
+        }
+        compiled += session.return_compiled();
+        kept += session.return_kept();
+        bool written = write_file_atomically(tokenizer_file_names[i], session.return_tokens()) && write_file_atomically(parser_file_names[i], session.return_parse_string()) &&
+                       write_file_atomically(vm_file_names[i], session.return_vm_file());
+        if(written)
+        {
+            write_file_atomically(dependency_file(i), dependency_record(i, session.return_used_signatures()));
+        }
+    }
+    long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Rebuilt " << stale - failed << " of " << file_name.size() << " files, " << failed << " with errors, " << compiled << " subroutines compiled, "
+              << kept << " kept, " << ms << " ms" << std::endl;
+}
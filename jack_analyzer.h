@@ -4,6 +4,13 @@
 #include <filesystem>
 #include "jack_tokenizer.h"
 #include "compilation_engine.h"
+#include "compile_options.h"
+#include "profile.h"
+#include "async_io.h"
+#include "signature_index.h"
+#include "class_session.h"
+#include <map>
+#include <set>
 
 #pragma once
 
@@ -20,13 +27,34 @@ private:
     std::vector<std::string> parser_file_names;
     std::vector<std::string> vm_file_names;
     bool file_or_not; //stores the directory name
-    std::ofstream token_filehandle;
-    std::ofstream parser_filehandle;
-    std::ofstream vm_handle;
     std::string vm_file_name;
+    compile_options options;
+    std::string directory; //where the sources are, the profiling run loads every .vm file in it
+    profile_data profile;
+    signature_index signatures; //built before the first file is compiled, read only after that
+    std::vector<int> stale_files; //files whose outputs are missing or out of date, only these are compiled
+    static const size_t read_ahead = 4; //sources being read while the current one compiles
+    std::map<std::string,class_session> sessions; //--watch keeps every class it has compiled, by source path
+    static const int debounce_ms = 100; //--watch takes saves closer together than this as one change
+
+    void generate_profile();
+    void compile_file(int i, tokenizer::jack_tokenizer jt, output_writer& writer);
+    void compile_streaming(int i);
+    void compile_in_workers();
+    void run_worker(int from_parent, int to_parent);
+    std::string token_dump(tokenizer::jack_tokenizer& jt);
+    bool up_to_date(int i);
+    std::string dependency_file(int i);
+    std::string dependency_record(int i, const std::set<std::string>& used_signatures);
+    std::string options_key();
+    void add_source(const std::string& path);
+    void find_sources();
+    void rebuild();
+    bool source_changed(int fd, int timeout_ms);
 
 
 public:
-    jack_analyzer(std::string file_name);
+    jack_analyzer(std::string file_name, compile_options opts = {});
     void analyze();
+    void watch(); //never returns
 };
\ No newline at end of file
@@ -7,16 +7,102 @@
 #include "jack_tokenizer.h"
 #include "symbol_table.h"
 #include "vm_writer.h"
+#include "compile_options.h"
+#include "lsp_server.h"
+#include "jack_pipe.h"
 
 
 int main(int argc, char *argv[])
 {
-    if(argc != 2)
+    compile_options options;
+    std::string name;
+    for(int i = 1; i < argc; i++)
     {
-        std::cerr << "Usage : ./[name] filename \n";
+        std::string arg = argv[i];
+        if(arg == "--inline-intrinsics")
+        {
+            options.inline_intrinsics = true;
+        }
+        else if((arg == "--profile-generate" || arg == "--profile-use") && i + 1 < argc)
+        {
+            (arg == "--profile-generate" ? options.profile_generate : options.profile_use) = argv[++i];
+        }
+        else if(arg == "--stream")
+        {
+            options.stream = true;
+        }
+        else if(arg == "--rebuild")
+        {
+            options.rebuild = true;
+        }
+        else if(arg == "--watch")
+        {
+            options.watch = true;
+        }
+        else if(arg == "--emit" && i + 1 < argc && (std::string(argv[i + 1]) == "vm" || std::string(argv[i + 1]) == "xml" || std::string(argv[i + 1]) == "tokens"))
+        {
+            options.emit = argv[++i];
+        }
+        else if(arg == "--framed")
+        {
+            options.framed = true;
+        }
+        else if(arg == "--lsp")
+        {
+            options.lsp = true;
+        }
+        else if(arg == "--pipeline")
+        {
+            options.pipeline = true;
+        }
+        else if(arg == "--jobs" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            options.jobs = std::atoi(argv[++i]);
+        }
+        else if(arg == "--workers" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            options.workers = std::atoi(argv[++i]);
+        }
+        else if(arg == "--max-nesting" && i + 1 < argc && std::atoi(argv[i + 1]) > 0)
+        {
+            options.max_nesting = std::atoi(argv[++i]);
+        }
+        else if(name == "" && (arg[0] != '-' || arg == "-"))
+        {
+            name = arg;
+        }
+        else
+        {
+            name = "";
+            break;
+        }
+    }
+    if(options.lsp && name == "" && options.profile_generate == "" && options.profile_use == "")
+    {
+        return lsp_server{options}.run();
+    }
+    if(name == "" || (options.profile_generate != "" && options.profile_use != "") || (options.stream && options.profile_use != "") ||
+       (options.watch && (options.profile_generate != "" || options.profile_use != "")) || (options.framed && name != "-") ||
+       (name == "-" && (options.watch || options.stream || options.workers > 0 || options.profile_generate != "" || options.profile_use != "")))
+    {
+        std::cerr << "Usage : ./[name] --lsp [--inline-intrinsics] [--max-nesting n]\n";
+        std::cerr << "Usage : ./[name] [--inline-intrinsics] [--jobs n] [--max-nesting n] [--emit vm | xml | tokens] [--framed] -\n";
+        std::cerr << "Usage : ./[name] [--inline-intrinsics] [--jobs n] [--workers n] [--max-nesting n] [--rebuild] [--watch] [--pipeline] [--stream] [--profile-generate file | --profile-use file] filename \n";
         return(1);
     }
 
-    jack_analyzer v (argv[1]);
-    v.analyze();
+    if(name == "-")
+    {
+        return compile_pipe(options);
+    }
+
+    jack_analyzer v (name, options);
+    if(options.watch)
+    {
+        v.watch();
+    }
+    else
+    {
+        v.analyze();
+    }
 }
\ No newline at end of file
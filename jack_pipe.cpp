@@ -0,0 +1,128 @@
+#include "jack_pipe.h"
+#include "jackc.h"
+#include <iostream>
+#include <sstream>
+#include <iterator>
+#include <thread>
+#include <future>
+#include <atomic>
+#include <algorithm>
+
+static const std::string& selected_output(const jackc::result& r, const std::string& emit)
+{
+    return emit == "xml" ? r.xml : emit == "tokens" ? r.tokens : r.vm;
+}
+
+static std::string error_text(const jackc::result& r) //the lines the command line prints for the same errors
+{
+    std::string text;
+    for(const syntax_error& e : r.errors)
+    {
+        text += "Syntax Error : " + e.what + std::to_string(e.line) + "\n";
+    }
+    return text;
+}
+
+static bool read_frames(std::istream& in, std::vector<std::string>& names, std::vector<std::string>& sources)
+{
+    std::string header;
+    while(std::getline(in, header))
+    {
+        if(header.empty())
+        {
+            continue;
+        }
+        std::istringstream fields(header);
+        std::string record, name;
+        long long bytes = -1;
+        fields >> record >> name >> bytes;
+        if(record != "file" || name.empty() || bytes < 0)
+        {
+            std::cerr << "Bad frame header : " << header << std::endl;
+            return false;
+        }
+        std::string source(bytes, '\0');
+        if(!in.read(&source[0], bytes))
+        {
+            std::cerr << "Frame " << name << " ends early" << std::endl;
+            return false;
+        }
+        names.push_back(name);
+        sources.push_back(std::move(source));
+    }
+    return true;
+}
+
+static void write_out(const std::string& text)
+{
+    std::cout.write(text.data(), text.size());
+}
+
+int compile_pipe(const compile_options& options)
+{
+    std::ios::sync_with_stdio(false);
+    compile_options class_options = options;
+    class_options.parse_tree = options.emit == "xml";
+    if(!options.framed)
+    {
+        std::string source((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+        signature_index signatures;
+        signatures.build_in_memory({"-"}, {source});
+        jackc::result r = jackc::compile(source, class_options, &signatures);
+        std::cerr << r.lexer_messages;
+        if(!r.ok)
+        {
+            std::cerr << error_text(r);
+            return 1;
+        }
+        write_out(selected_output(r, options.emit));
+        std::cout.flush();
+        return 0;
+    }
+
+    std::vector<std::string> names, sources;
+    if(!read_frames(std::cin, names, sources))
+    {
+        return 1;
+    }
+    signature_index signatures;
+    signatures.build_in_memory(names, sources);
+
+    // the classes compile on the threads and are written here in order, each as soon as it and those before it are done
+    class_options.jobs = 1;
+    std::vector<std::promise<jackc::result>> done(names.size());
+    std::vector<std::future<jackc::result>> results;
+    for(auto& p : done)
+    {
+        results.push_back(p.get_future());
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> workers;
+    int threads = std::clamp<int>(options.jobs, 1, std::max<int>(names.size(), 1));
+    for(int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+        {
+            for(size_t i = next++; i < names.size(); i = next++)
+            {
+                done[i].set_value(jackc::compile(sources[i], class_options, &signatures));
+            }
+        });
+    }
+    bool failed = false;
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        jackc::result r = results[i].get();
+        std::cerr << r.lexer_messages;
+        std::string body = r.ok ? selected_output(r, options.emit) : error_text(r);
+        write_out("file " + names[i] + " " + std::to_string(body.size()) + (r.ok ? " ok\n" : " error\n"));
+        write_out(body);
+        std::cout.flush();
+        failed = failed || !r.ok;
+    }
+    for(std::thread& t : workers)
+    {
+        t.join();
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "compile_options.h"
+
+/*
+Compiling "-": sources come in on stdin and the output picked by --emit goes out on stdout, nothing touches the
+disk. All of stdin is one class, unless --framed makes it a run of frames
+file <name> <bytes>\n<the source, exactly that many bytes>
+each answered on stdout in the same order with
+file <name> <bytes> ok\n<the output>        or        file <name> <bytes> error\n<its syntax errors, one per line>
+Framed classes are checked against each other's signatures like the files of a directory, and with --jobs n they
+compile on n threads. What the lexer reports goes to stderr. Returns the exit code, 1 when any class has errors.
+*/
+int compile_pipe(const compile_options& options);
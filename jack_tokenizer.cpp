@@ -1,7 +1,9 @@
 #include<filesystem>
 #include <fstream>
+#include <thread>
 #include "regex_utils.h"
 #include "jack_tokenizer.h"
+#include "char_scan.h"
 
 
 //==================================================================================================================================================================
@@ -15,76 +17,228 @@ Grammer
 namespace tokenizer
 {
 
-void jack_tokenizer::tokenize() // main tokenizing function
+// files of a megabyte or more are split into one chunk per job at line boundaries, preferring lines that end a
+// statement or block, and the chunks are lexed at once as if each started between tokens. a chunk whose last
+// token, string or comment runs past its end is lexed again together with the next chunk, on until the end of
+// the file where the ordinary lexer runs, so the tokens and errors are always the ones a single pass gives
+void jack_tokenizer::tokenize(const std::vector<std::string>& lines, int jobs)
 {
-    char c;
-    
-    while(!EOF_())
+    const size_t parallel_min_bytes = 1 << 20;
+    size_t total_bytes = max_tokens(lines, 0, lines.size());
+    token_list.open(total_bytes);
+    if(jobs <= 1 || total_bytes < parallel_min_bytes)
     {
-        c = get_char();
-        switch (c)
+        lex_lines(lines, 0, lines.size(), false);
+        token_list.finish();
+        return;
+    }
+
+    std::vector<int> bounds{0};
+    size_t chunk_bytes = total_bytes / jobs, bytes = 0;
+    for(int i = 0, n = lines.size(); i < n; i++)
+    {
+        bytes += lines[i].size() + 1;
+        size_t last = lines[i].find_last_not_of(" \t\r");
+        bool boundary = last == std::string::npos || lines[i][last] == ';' || lines[i][last] == '{' || lines[i][last] == '}';
+        if(bytes >= chunk_bytes && boundary && i + 1 < n && (int)bounds.size() < jobs)
         {
-            case '{': case '}': case '(': case ')': case ';': case '.': case '[': case ']': case ',':
-            case '+': case '=': case '*': case '&': case '|': case '<': case '>': case '-': case '~':
-                token_list.push_back(token{token_type::SYMBOL,std::string{c},line_num});
-                break;
+            bounds.push_back(i + 1);
+            bytes = 0;
+        }
+    }
+    bounds.push_back(lines.size());
+    int chunks = bounds.size() - 1;
 
-            case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
-            {
-                std::string num = get_num();
-                token_list.push_back(token{token_type::INT_CONST,num,line_num});
-                break;
-            }
+    std::vector<jack_tokenizer> lexers(chunks);
+    std::vector<std::thread> workers;
+    for(int i = 0; i < chunks; i++)
+    {
+        workers.emplace_back([&lexers, &lines, &bounds, i]()
+        {
+            lexers[i].token_list.open(max_tokens(lines, bounds[i], bounds[i + 1]));
+            lexers[i].lex_lines(lines, bounds[i], bounds[i + 1], true);
+        });
+    }
+    for(std::thread& t : workers)
+    {
+        t.join();
+    }
 
-            case '"':
-            {
-                std::string str = get_string_const();
+    for(int i = 0; i < chunks;)
+    {
+        int j = i;
+        while(lexers[i].overran)
+        {
+            j = std::min(j + 1, chunks - 1);
+            lexers[i].token_list.open(max_tokens(lines, bounds[i], bounds[j + 1]));
+            lexers[i].lex_lines(lines, bounds[i], bounds[j + 1], j + 1 < chunks);
+        }
+        std::cerr << lexers[i].diagnostics;
+        lexers[i].token_list.finish();
+        for(size_t k = 0; lexers[i].token_list.has(k); k++)
+        {
+            token_list.push_back(lexers[i].token_list[k]);
+        }
+        i = j + 1;
+    }
+    token_list.finish();
+}
+
+// the lexer fills the shared token buffer from a detached thread that owns the lines, so the parser can start on
+// the first tokens. a parser reaching tokens that are not lexed yet waits in token_buffer::has
+void jack_tokenizer::lex_in_background(std::vector<std::string> lines)
+{
+    token_list.open(max_tokens(lines, 0, lines.size()));
+    jack_tokenizer lexer;
+    lexer.token_list = token_list;
+    std::thread([lexer = std::move(lexer), lines = std::move(lines)]() mutable
+    {
+        lexer.lex_lines(lines, 0, lines.size(), false);
+        lexer.token_list.finish();
+    }).detach();
+}
 
-                token_list.push_back(token{token_type::STRING_CONST,str,line_num});
+void jack_tokenizer::lex_file_in_background(const std::string& file_name) //like lex_in_background, the lines are read as they are lexed
+{
+    std::error_code ec;
+    size_t bytes = std::filesystem::file_size(file_name, ec);
+    token_list.open(ec ? size_t(1) << 31 : bytes + 1, 1 << 16); //without a size, room for files up to 2 GB
+    jack_tokenizer lexer;
+    lexer.token_list = token_list;
+    std::thread([lexer = std::move(lexer), file_name]() mutable
+    {
+        lexer.filehandle.open(file_name);
+        lexer.line_num = 0;
+        lexer.line = "";
+        lexer.current_char_pos = 0;
+        lexer.lex();
+        lexer.filehandle.close();
+        lexer.token_list.finish();
+    }).detach();
+}
 
-                break;
+// lexes lines [begin, end) on the calling thread, as a chunk that starts between tokens. returns false when the last
+// token, string or comment runs past end, otherwise prints the lexer's errors like a plain tokenize does
+bool jack_tokenizer::lex_range(const std::vector<std::string>& lines, int begin, int end, std::vector<int>* open)
+{
+    open_lines = open;
+    token_list.open(max_tokens(lines, begin, end));
+    lex_lines(lines, begin, end, true);
+    token_list.finish();
+    open_lines = nullptr;
+    if(overran)
+    {
+        return false;
+    }
+    std::cerr << diagnostics;
+    return true;
+}
 
-            }
+// every line on the calling thread, for callers that can't have the lexer print or end the program. the errors a
+// plain tokenize prints are put in messages instead, and a comment running to the end of the source, which ends
+// the program there, returns false. the tokens are the same, a string or token cut off by the end of the source
+// ends there either way
+bool jack_tokenizer::lex_quietly(const std::vector<std::string>& lines, std::string& messages)
+{
+    token_list.open(max_tokens(lines, 0, lines.size()));
+    lex_lines(lines, 0, lines.size(), true);
+    token_list.finish();
+    messages = diagnostics;
+    return !comment_open;
+}
 
-            case '/' : // '/' symbol can signifies division or comments so special case
-            {
-                if(!check_comment())
-                {
-                    token_list.push_back(token{token_type::SYMBOL,std::string{c},line_num});
-                }
-                break;
-            }
+size_t jack_tokenizer::max_tokens(const std::vector<std::string>& lines, int begin, int end)
+{
+    size_t bytes = 0;
+    for(int i = begin; i < end; i++)
+    {
+        bytes += lines[i].size() + 1;
+    }
+    return bytes;
+}
 
-            case ' ': case '\t': case '\n': case '\r':
-                break; // do nothing if space comes up
+void jack_tokenizer::lex_lines(const std::vector<std::string>& lines, int begin, int end, bool spec)
+{
+    source = &lines;
+    next_line = begin;
+    end_line = end;
+    line_num = begin;
+    line = "";
+    current_char_pos = 0;
+    speculative = spec;
+    overran = false;
+    comment_open = false;
+    diagnostics.clear();
+    lex();
+    source = nullptr;
+}
 
-            default:
+void jack_tokenizer::report(const std::string& what)
+{
+    if(speculative)
+    {
+        diagnostics.append(what);
+    }
+    else
+    {
+        std::cerr << what;
+    }
+}
+
+void jack_tokenizer::lex() // main tokenizing function
+{
+    char c;
+    
+    while(!EOF_())
+    {
+        between_tokens = true;
+        c = get_char();
+        between_tokens = false;
+        unsigned char cls = char_class_of(c);
+        if(cls & SLASH_CHAR) // '/' symbol can signifies division or comments so special case
+        {
+            if(!check_comment())
             {
-                if(isalpha(c)|| c=='_')
-                {
-                    std::string str;
-                    str = get_identifier(); // this will get an identifier
-                    if(str == "class" || str == "constructor" || str == "function" || str == "method" || str == "field" || str == "static" || str == "var" ||
-                    str == "int" || str == "char" || str == "boolean" || str == "void" || str == "true" || str == "false" || str == "null" || str == "this" ||
-                        str == "let" || str == "do" || str == "if" || str == "else" || str == "while" || str == "return")
-                    {
-                        token_list.push_back(token{token_type::KEYWORD,str,line_num}); //this is an token
-                    }
-                    else
-                    {
-                        token_list.push_back(token{token_type::IDENTIFIER,str,line_num}); //this is an identifier
-                    }
-                }
-                else
-                {
-                    std::cerr << "Error at line: char " << int(c) <<" " << line_num << std::endl;
-                }
-                break;
+                token_list.push_back(token{token_type::SYMBOL,std::string{c},line_num});
             }
-        
-
         }
-
+        else if(cls & SYMBOL_CHAR)
+        {
+            token_list.push_back(token{token_type::SYMBOL,std::string{c},line_num});
+        }
+        else if(cls & BLANK_CHAR)
+        {
+            current_char_pos += blank_run(line.data() + current_char_pos, line.length() - current_char_pos); //the rest of the blanks on this line
+        }
+        else if(cls & IDENT_START)
+        {
+            std::string str;
+            str = get_identifier(); // this will get an identifier
+            if(str == "class" || str == "constructor" || str == "function" || str == "method" || str == "field" || str == "static" || str == "var" ||
+            str == "int" || str == "char" || str == "boolean" || str == "void" || str == "true" || str == "false" || str == "null" || str == "this" ||
+                str == "let" || str == "do" || str == "if" || str == "else" || str == "while" || str == "return")
+            {
+                token_list.push_back(token{token_type::KEYWORD,str,line_num}); //this is an token
+            }
+            else
+            {
+                token_list.push_back(token{token_type::IDENTIFIER,str,line_num}); //this is an identifier
+            }
+        }
+        else if(cls & DIGIT_CHAR)
+        {
+            std::string num = get_num();
+            token_list.push_back(token{token_type::INT_CONST,num,line_num});
+        }
+        else if(cls & QUOTE_CHAR)
+        {
+            std::string str = get_string_const();
+            token_list.push_back(token{token_type::STRING_CONST,str,line_num});
+        }
+        else
+        {
+            report("Error at line: char " + std::to_string(int(c)) + " " + std::to_string(line_num) + "\n");
+        }
     }
 }
 
@@ -97,14 +251,19 @@ char jack_tokenizer::get_char() //returns next character from the file
         line = "";
         while(line == "")  // loop until we get a non empty line
         {
-            if(filehandle.peek() == EOF) //if we reach the end of file we return a space and set the current char pos to zero so the tokenizer loop will
+            if(source_ended()) //if we reach the end of file we return a space and set the current char pos to zero so the tokenizer loop will
                                         // in the next iteration as EOF_() will return true
             {
                 current_char_pos = 0;
+                overran = overran || (speculative && !between_tokens);
                 return ' ';
             }
-            std::getline(filehandle,line);
+            read_line();
             line_num+=1;
+            if(open_lines != nullptr && !between_tokens)
+            {
+                open_lines->push_back(line_num - 1);
+            }
             
         }
         current_char_pos = 0; //set the position to 0
@@ -117,11 +276,29 @@ char jack_tokenizer::get_char() //returns next character from the file
 }
 
 
+//=========================================================================================================================================================================
+bool jack_tokenizer::source_ended() //lines come from memory while tokenizing, from the file itself when streaming
+{
+    return source != nullptr ? next_line == end_line : filehandle.peek() == EOF;
+}
+
+void jack_tokenizer::read_line()
+{
+    if(source != nullptr)
+    {
+        line = (*source)[next_line++];
+    }
+    else
+    {
+        std::getline(filehandle, line);
+    }
+}
+
 //=========================================================================================================================================================================
 bool jack_tokenizer::EOF_() //returns whether the file have reached the end of file
 {
     bool flag = false;
-    if(current_char_pos == line.length() && filehandle.peek() == EOF)
+    if(current_char_pos == line.length() && source_ended())
     {
         flag =  true; //returns true if its the end of file
     }
@@ -136,7 +313,7 @@ std::string jack_tokenizer::get_num()
     std::string num;
     current_char_pos -= 1; //as the we need to get back the first character which is already consumed by the tokenizer
     char c = get_char();
-    while(isdigit(c))
+    while(char_class_of(c) & DIGIT_CHAR)
     {
         num+=c;
         c = get_char();
@@ -149,13 +326,24 @@ std::string jack_tokenizer::get_num()
 std::string jack_tokenizer::get_string_const() //this function returns the a string until the provided character is found
 {
     std::string str;
-    char c = get_char();
-    while(c != '"')
+    while(true)
     {
+        size_t rest = line.length() - current_char_pos;
+        size_t quote = find_char(line.data() + current_char_pos, rest, '"');
+        str.append(line, current_char_pos, quote);
+        current_char_pos += quote;
+        if(quote < rest)
+        {
+            current_char_pos += 1;
+            return str;
+        }
+        char c = get_char(); //the string goes on to the next line
+        if(c == '"' || overran)
+        {
+            return str;
+        }
         str += c;
-        c = get_char();
     }
-    return str;
 }
 
 //=======================================================================================================================================================================
@@ -174,11 +362,18 @@ bool jack_tokenizer::check_comment()
         char c2;
         while(true)
         {
+            if(EOF_() && speculative)
+            {
+                overran = true;
+                comment_open = true;
+                break;
+            }
             if(EOF_())
             {
                 std::cerr << "Commend end not found" << std::endl;
                 exit(0);
             }
+            current_char_pos += find_char(line.data() + current_char_pos, line.length() - current_char_pos, '*'); //nothing before the next * can end the comment
             c = get_char();
             
             if(c =='*')
@@ -202,15 +397,20 @@ bool jack_tokenizer::check_comment()
 
 std::string jack_tokenizer::get_identifier()
 {
-    std::string str;
     current_char_pos -= 1; //first character already consumed by the tokenizer
-    char c = get_char();
-    while(isalnum(c) || c == '_')
+    size_t run = identifier_run(line.data() + current_char_pos, line.length() - current_char_pos);
+    std::string str(line, current_char_pos, run);
+    current_char_pos += run;
+    if(current_char_pos == (int)line.length()) //the run reached the end of the line, it goes on if the next line starts with one
     {
-        str += c;
-        c = get_char();
+        char c = get_char();
+        while(char_class_of(c) & IDENT_CHAR)
+        {
+            str += c;
+            c = get_char();
+        }
+        current_char_pos -= 1; //returns the last character
     }
-    current_char_pos -= 1; //returns the last character
     return str;
 }
 
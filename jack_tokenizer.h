@@ -6,6 +6,12 @@
 #include <sstream>
 #include <algorithm>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "char_scan.h"
 
 
 namespace tokenizer
@@ -32,23 +38,165 @@ struct token
     std::string token_name;
     int line_num;
 
-    void print()
+    void print() const
     {
         std::cout << type << " " << token_name << " " << line_num << std::endl;
     }
 
 };
 
+inline std::string token_xml(const token& t) //the line of a token in the T.xml listing
+{
+    switch(t.type)
+    {
+        case token_type::KEYWORD: return std::string("\t<keyword>") + t.token_name + "</keyword>\n";
+        case token_type::INT_CONST: return std::string("\t<integerConstant>") + std::to_string(std::stoi(t.token_name)) + "</integerConstant>\n";
+        case token_type::IDENTIFIER: return std::string("\t<identifier>") + t.token_name + "</identifier>\n";
+        case token_type::STRING_CONST: return std::string("\t<stringConstant>") + t.token_name + "</stringConstant>\n";
+        default: return std::string("\t<symbol>") + xml_symbol(t.token_name[0]) + "</symbol>\n";
+    }
+}
+
+//tokens are kept in blocks that never move, so the parser can read the tokens lexed so far while the lexer is
+//still adding to the end. copies share the tokens, a token is never changed once it is added
+class token_buffer
+{
+    static constexpr size_t block_bits = 12;
+    static constexpr size_t block_size = size_t(1) << block_bits;
+
+    struct storage
+    {
+        std::vector<std::unique_ptr<token[]>> blocks; //sized when opened, from the most tokens the source can hold
+        std::atomic<size_t> count{0};
+        std::atomic<bool> finished{false};
+        std::atomic<size_t> wanted{0}; //one past the furthest token asked for
+        size_t window = 0; //when set the lexer stays at most this many tokens ahead of the reader, at least a block
+        std::mutex waiting;
+        std::condition_variable lexed; //a reader waiting for tokens is woken once per block filled and at the end
+        std::condition_variable read; //a lexer a window ahead is woken once per block the reader moves into
+    };
+    std::shared_ptr<storage> s;
+
+public:
+    void open(size_t max_tokens, size_t window = 0) //starts a new empty buffer, copies made before keep the old one
+    {
+        s = std::make_shared<storage>();
+        s->blocks.resize(max_tokens / block_size + 1);
+        s->window = window == 0 ? 0 : std::max(window, block_size);
+    }
+
+    void push_back(token t) //only called by the one lexer filling the buffer
+    {
+        size_t n = s->count.load(std::memory_order_relaxed);
+        if(s->window != 0 && n >= s->wanted.load(std::memory_order_acquire) + s->window)
+        {
+            std::unique_lock<std::mutex> lock(s->waiting);
+            s->read.wait(lock, [this, n]()
+            {
+                return n < s->wanted.load(std::memory_order_acquire) + s->window;
+            });
+        }
+        std::unique_ptr<token[]>& block = s->blocks[n >> block_bits];
+        if(!block)
+        {
+            block.reset(new token[block_size]);
+        }
+        block[n & (block_size - 1)] = std::move(t);
+        s->count.store(n + 1, std::memory_order_release);
+        if(((n + 1) & (block_size - 1)) == 0)
+        {
+            std::lock_guard<std::mutex> lock(s->waiting); //a reader between checking count and waiting would miss the wakeup
+            s->lexed.notify_all();
+        }
+    }
+
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(s->waiting);
+        s->finished.store(true, std::memory_order_release);
+        s->lexed.notify_all();
+    }
+
+    bool has(size_t i) const //waits for the lexer until token i is there or the source has ended
+    {
+        if(!s)
+        {
+            return false;
+        }
+        if(s->finished.load(std::memory_order_acquire)) //lexed before it is read, or the lexer is done
+        {
+            return i < s->count.load(std::memory_order_acquire);
+        }
+        size_t wanted = s->wanted.load(std::memory_order_relaxed);
+        if(i >= wanted)
+        {
+            s->wanted.store(i + 1, std::memory_order_release);
+            if(s->window != 0 && ((i + 1) >> block_bits) != (wanted >> block_bits))
+            {
+                std::lock_guard<std::mutex> lock(s->waiting);
+                s->read.notify_one();
+            }
+        }
+        if(i < s->count.load(std::memory_order_acquire))
+        {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(s->waiting);
+        s->lexed.wait(lock, [this, i]()
+        {
+            return i < s->count.load(std::memory_order_acquire) || s->finished.load(std::memory_order_acquire);
+        });
+        return i < s->count.load(std::memory_order_acquire);
+    }
+
+    size_t size() const //number of tokens in the whole source, waits for the lexer to finish
+    {
+        size_t n = 0;
+        while(has(n))
+        {
+            n = s->count.load(std::memory_order_acquire);
+        }
+        return n;
+    }
+
+    void release_before(size_t i) //frees the blocks that only hold tokens before i, which must not be read again
+    {
+        for(size_t b = 0; b < (i >> block_bits); b++)
+        {
+            s->blocks[b].reset();
+        }
+    }
+
+    const token& operator[](size_t i) const //past the last token this is an empty token on line 0
+    {
+        static const token end_token{token_type::SYMBOL, "", 0};
+        if(!has(i))
+        {
+            return end_token;
+        }
+        return s->blocks[i >> block_bits][i & (block_size - 1)];
+    }
+};
+
 
 class jack_tokenizer
 {   
 private:
     std::ifstream filehandle;
-    std::vector<token> token_list;
+    token_buffer token_list;
     std::string file_str;
     std::string line;
     int line_num; //stores the current line being processed;
     int current_char_pos; //strores the current character position within a line
+    const std::vector<std::string>* source = nullptr; //lines of the file, only set while tokenizing
+    int next_line = 0; //next line of source get_char reads
+    int end_line = 0; //lines from here on belong to another chunk
+    bool speculative = false; //set when lexing a chunk that may not start at a token boundary
+    bool between_tokens = true;
+    bool overran = false; //a token, string or comment reached the end of a speculative chunk
+    bool comment_open = false; //what overran was a comment
+    std::string diagnostics; //errors of a speculative chunk, printed once the chunk is known to be right
+    std::vector<int>* open_lines = nullptr; //when set, collects the lines that start inside a token, string or comment
 
     //_______________________________________________________________________________________
 
@@ -63,7 +211,9 @@ public:
     jack_tokenizer() = default;
     
     
-    explicit jack_tokenizer(std::string& file_name)
+    explicit jack_tokenizer(std::string& file_name, int jobs = 1, bool pipelined = false, bool streamed = false) //jobs > 1 lexes large files in chunks on that many threads,
+                                                                                          //pipelined lexes on a thread of its own while the tokens are used,
+                                                                                          //streamed also reads the file a line at a time on that thread
     {    
         filehandle.open(file_name);
         line_num = 0;
@@ -73,7 +223,27 @@ public:
         {
             throw std::runtime_error("Failed to open file: " + file_name);
         }
-        tokenize();
+        if(streamed)
+        {
+            filehandle.close();
+            lex_file_in_background(file_name);
+            return;
+        }
+        std::vector<std::string> lines;
+        std::string l;
+        while(std::getline(filehandle, l))
+        {
+            lines.push_back(l);
+        }
+        filehandle.close();
+        start(std::move(lines), jobs, pipelined);
+    }
+
+    jack_tokenizer(std::vector<std::string> lines, int jobs, bool pipelined) //lines of a file that is already read
+    {
+        line_num = 0;
+        current_char_pos = 0;
+        start(std::move(lines), jobs, pipelined);
     }
 
     jack_tokenizer(jack_tokenizer& jt) : token_list{jt.token_list},file_str {jt.file_str},line {jt.line},line_num {jt.line_num},current_char_pos {jt.current_char_pos},current_token{jt.current_token}
@@ -130,9 +300,12 @@ public:
 
     void print();//it will print the entire tokens
 
+    bool lex_range(const std::vector<std::string>& lines, int begin, int end, std::vector<int>* open = nullptr);
+    bool lex_quietly(const std::vector<std::string>& lines, std::string& messages);
+
     bool has_more_token() const//check if there is any more token
     {
-        return !(current_token == token_list.size());
+        return token_list.has(current_token);
     }
     
     token_type return_token_type() const //returns the type of token
@@ -177,6 +350,30 @@ public:
         return token_list[current_token + 1].type;
     }
 
+    const token* peek_token(int offset) const //returns the token offset places after the current one, nullptr past the last token
+    {
+        if(current_token + offset < 0 || !token_list.has(current_token + offset))
+        {
+            return nullptr;
+        }
+        return &token_list[current_token + offset];
+    }
+
+    int return_token_position() const //index of the current token, can be given back to set_token_position
+    {
+        return current_token;
+    }
+
+    void set_token_position(int pos)
+    {
+        current_token = pos;
+    }
+
+    void release_tokens_before(int pos) //streaming frees the tokens of finished subroutines, nothing before pos may be read again
+    {
+        token_list.release_before(pos);
+    }
+
     void reset_token_seeker()
     {
         current_token = 0;
@@ -189,7 +386,26 @@ public:
     }
 private:
     //private tokenizing function functions which are called from the constructor
-    void tokenize();
+    void start(std::vector<std::string> lines, int jobs, bool pipelined)
+    {
+        if(pipelined)
+        {
+            lex_in_background(std::move(lines));
+        }
+        else
+        {
+            tokenize(lines, jobs);
+        }
+    }
+    void tokenize(const std::vector<std::string>& lines, int jobs);
+    void lex_in_background(std::vector<std::string> lines);
+    void lex_file_in_background(const std::string& file_name);
+    bool source_ended();
+    void read_line();
+    static size_t max_tokens(const std::vector<std::string>& lines, int begin, int end); //every token takes at least one character
+    void lex_lines(const std::vector<std::string>& lines, int begin, int end, bool spec); //lexes lines [begin, end) as if they were the whole file
+    void lex();
+    void report(const std::string& what);
     char get_char();//This function returns the next character until the last read;
     std::string get_string_const(); //this function returns the a string until the provided character is found
     bool EOF_(); // returns whether the file handle have reached the end of file
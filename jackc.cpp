@@ -0,0 +1,43 @@
+#include "jackc.h"
+#include "jack_tokenizer.h"
+#include "async_io.h"
+
+namespace jackc
+{
+
+result compile(std::string_view source, compile_options options, const signature_index* signatures)
+{
+    result out;
+    options.trace = false;
+    options.profile_generate.clear();
+    options.profile_use.clear();
+    options.stream = false;
+
+    std::vector<std::string> lines = split_source_lines(source);
+    tokenizer::jack_tokenizer tokens;
+    if(!tokens.lex_quietly(lines, out.lexer_messages))
+    {
+        out.errors.push_back(syntax_error{"Commend end not found, line: ", (int)lines.size()}); //the command line's words
+        return out;
+    }
+
+    compilation_engine engine{tokens, options};
+    engine.use_signatures(signatures);
+    if(!engine.compile_collecting_errors())
+    {
+        out.errors = engine.take_errors();
+        return out;
+    }
+    out.tokens = "<token>\n";
+    for(int k = 0; tokens.peek_token(k) != nullptr; k++)
+    {
+        out.tokens.append(tokenizer::token_xml(*tokens.peek_token(k)));
+    }
+    out.tokens.append("</token>\n");
+    out.xml = engine.take_parse_string();
+    out.vm = engine.return_vm_file();
+    out.ok = true;
+    return out;
+}
+
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include "compilation_engine.h"
+#include "compile_options.h"
+#include "signature_index.h"
+
+/*
+The compiler as a library: one class from a string to its vm code, parse tree and token listing, all in memory.
+Nothing is read or written and nothing is printed, errors come back in the result instead of ending the program.
+
+Every call has a tokenizer, engine and vm_writer of its own, so calls can run at once on any number of threads.
+A signature_index shared between them is only read. Options that need files, the profiles, are ignored, and the
+parser's trace is always off.
+*/
+
+namespace jackc
+{
+
+struct result
+{
+    bool ok = false; //false when the class has syntax errors, the outputs are empty then
+    std::string vm;
+    std::string xml; //what the command line writes to Name.xml, empty when options.parse_tree is off
+    std::string tokens; //what it writes to NameT.xml
+    std::vector<syntax_error> errors;
+    std::string lexer_messages; //characters the lexer skipped, one line each as the command line prints them
+};
+
+//signatures, when given, checks calls into other classes the way a directory compile does
+result compile(std::string_view source, compile_options options = {}, const signature_index* signatures = nullptr);
+
+}
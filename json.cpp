@@ -0,0 +1,330 @@
+#include "json.h"
+#include <stdexcept>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+static const json_value null_value;
+
+static void skip_space(const std::string& in, size_t& pos)
+{
+    while(pos < in.size() && (in[pos] == ' ' || in[pos] == '\t' || in[pos] == '\n' || in[pos] == '\r'))
+    {
+        pos++;
+    }
+}
+
+static void append_utf8(unsigned code, std::string& out)
+{
+    if(code < 0x80)
+    {
+        out += (char)code;
+    }
+    else if(code < 0x800)
+    {
+        out += (char)(0xC0 | (code >> 6));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else if(code < 0x10000)
+    {
+        out += (char)(0xE0 | (code >> 12));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (code >> 18));
+        out += (char)(0x80 | ((code >> 12) & 0x3F));
+        out += (char)(0x80 | ((code >> 6) & 0x3F));
+        out += (char)(0x80 | (code & 0x3F));
+    }
+}
+
+json_value json_value::parse(const std::string& in)
+{
+    size_t pos = 0;
+    json_value v = parse_value(in, pos);
+    skip_space(in, pos);
+    if(pos != in.size())
+    {
+        throw std::runtime_error("json: text after the value");
+    }
+    return v;
+}
+
+std::string json_value::parse_string(const std::string& in, size_t& pos) //pos is on the opening quote
+{
+    std::string s;
+    pos++;
+    while(pos < in.size() && in[pos] != '"')
+    {
+        size_t plain = std::min(in.find_first_of("\"\\", pos), in.size()); //a document's text is mostly one long run
+        s.append(in, pos, plain - pos);
+        pos = plain;
+        if(pos == in.size() || in[pos] == '"')
+        {
+            break;
+        }
+        if(pos + 1 == in.size())
+        {
+            pos = in.size();
+            break;
+        }
+        char c = in[pos + 1];
+        pos += 2;
+        switch(c)
+        {
+            case 'n': s += '\n'; break;
+            case 't': s += '\t'; break;
+            case 'r': s += '\r'; break;
+            case 'b': s += '\b'; break;
+            case 'f': s += '\f'; break;
+            case 'u':
+            {
+                if(pos + 4 > in.size())
+                {
+                    throw std::runtime_error("json: short \\u escape");
+                }
+                unsigned code = std::strtoul(in.substr(pos, 4).c_str(), nullptr, 16);
+                pos += 4;
+                if(code >= 0xD800 && code < 0xDC00 && pos + 6 <= in.size() && in[pos] == '\\' && in[pos + 1] == 'u') //a surrogate pair
+                {
+                    unsigned low = std::strtoul(in.substr(pos + 2, 4).c_str(), nullptr, 16);
+                    pos += 6;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                append_utf8(code, s);
+                break;
+            }
+            default: s += c; //\" \\ \/
+        }
+    }
+    if(pos == in.size())
+    {
+        throw std::runtime_error("json: unterminated string");
+    }
+    pos++;
+    return s;
+}
+
+json_value json_value::parse_value(const std::string& in, size_t& pos)
+{
+    skip_space(in, pos);
+    if(pos == in.size())
+    {
+        throw std::runtime_error("json: value expected");
+    }
+    char c = in[pos];
+    if(c == '{')
+    {
+        json_value v = object();
+        pos++;
+        skip_space(in, pos);
+        if(pos < in.size() && in[pos] == '}')
+        {
+            pos++;
+            return v;
+        }
+        while(true)
+        {
+            skip_space(in, pos);
+            if(pos == in.size() || in[pos] != '"')
+            {
+                throw std::runtime_error("json: member name expected");
+            }
+            std::string key = parse_string(in, pos);
+            skip_space(in, pos);
+            if(pos == in.size() || in[pos] != ':')
+            {
+                throw std::runtime_error("json: : expected");
+            }
+            pos++;
+            v.members.emplace_back(std::move(key), parse_value(in, pos));
+            skip_space(in, pos);
+            if(pos < in.size() && in[pos] == ',')
+            {
+                pos++;
+                continue;
+            }
+            if(pos < in.size() && in[pos] == '}')
+            {
+                pos++;
+                return v;
+            }
+            throw std::runtime_error("json: , or } expected");
+        }
+    }
+    if(c == '[')
+    {
+        json_value v = array();
+        pos++;
+        skip_space(in, pos);
+        if(pos < in.size() && in[pos] == ']')
+        {
+            pos++;
+            return v;
+        }
+        while(true)
+        {
+            v.items.push_back(parse_value(in, pos));
+            skip_space(in, pos);
+            if(pos < in.size() && in[pos] == ',')
+            {
+                pos++;
+                continue;
+            }
+            if(pos < in.size() && in[pos] == ']')
+            {
+                pos++;
+                return v;
+            }
+            throw std::runtime_error("json: , or ] expected");
+        }
+    }
+    if(c == '"')
+    {
+        return json_value{parse_string(in, pos)};
+    }
+    if(in.compare(pos, 4, "true") == 0 || in.compare(pos, 5, "false") == 0)
+    {
+        bool b = c == 't';
+        pos += b ? 4 : 5;
+        return json_value{b};
+    }
+    if(in.compare(pos, 4, "null") == 0)
+    {
+        pos += 4;
+        return json_value{};
+    }
+    char* end = nullptr;
+    double n = std::strtod(in.c_str() + pos, &end);
+    if(end == in.c_str() + pos)
+    {
+        throw std::runtime_error("json: value expected");
+    }
+    pos = end - in.c_str();
+    return json_value{n};
+}
+
+const json_value& json_value::operator[](const std::string& key) const
+{
+    for(const auto& m : members)
+    {
+        if(m.first == key)
+        {
+            return m.second;
+        }
+    }
+    return null_value;
+}
+
+const json_value& json_value::operator[](size_t i) const
+{
+    return type == json_type::array_j && i < items.size() ? items[i] : null_value;
+}
+
+json_value& json_value::set(const std::string& key, json_value v)
+{
+    type = json_type::object_j;
+    for(auto& m : members)
+    {
+        if(m.first == key)
+        {
+            m.second = std::move(v);
+            return *this;
+        }
+    }
+    members.emplace_back(key, std::move(v));
+    return *this;
+}
+
+json_value& json_value::push_back(json_value v)
+{
+    type = json_type::array_j;
+    items.push_back(std::move(v));
+    return *this;
+}
+
+std::string json_value::dump() const
+{
+    std::string out;
+    dump_to(out);
+    return out;
+}
+
+void json_value::dump_string(const std::string& s, std::string& out)
+{
+    out += '"';
+    for(char c : s)
+    {
+        switch(c)
+        {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\t': out += "\\t"; break;
+            case '\r': out += "\\r"; break;
+            default:
+                if((unsigned char)c < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                }
+                else
+                {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+void json_value::dump_to(std::string& out) const
+{
+    switch(type)
+    {
+        case json_type::null_j: out += "null"; break;
+        case json_type::bool_j: out += boolean ? "true" : "false"; break;
+        case json_type::number_j:
+        {
+            char digits[32];
+            if(std::floor(number) == number && std::fabs(number) < 1e15)
+            {
+                std::snprintf(digits, sizeof(digits), "%lld", (long long)number);
+            }
+            else
+            {
+                std::snprintf(digits, sizeof(digits), "%.17g", number);
+            }
+            out += digits;
+            break;
+        }
+        case json_type::string_j: dump_string(text, out); break;
+        case json_type::array_j:
+        {
+            out += '[';
+            for(size_t i = 0; i < items.size(); i++)
+            {
+                out += i > 0 ? "," : "";
+                items[i].dump_to(out);
+            }
+            out += ']';
+            break;
+        }
+        case json_type::object_j:
+        {
+            out += '{';
+            for(size_t i = 0; i < members.size(); i++)
+            {
+                out += i > 0 ? "," : "";
+                dump_string(members[i].first, out);
+                out += ':';
+                members[i].second.dump_to(out);
+            }
+            out += '}';
+            break;
+        }
+    }
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+
+//just enough json for the language server's messages. objects keep their members in order, a member that isn't
+//there reads as null so a request can be picked apart without checking each level
+
+enum json_type
+{
+    null_j,bool_j,number_j,string_j,array_j,object_j
+};
+
+class json_value
+{
+    json_type type = json_type::null_j;
+    bool boolean = false;
+    double number = 0;
+    std::string text;
+    std::vector<json_value> items;
+    std::vector<std::pair<std::string,json_value>> members;
+
+    static json_value parse_value(const std::string& in, size_t& pos);
+    static std::string parse_string(const std::string& in, size_t& pos);
+    static void dump_string(const std::string& s, std::string& out);
+    void dump_to(std::string& out) const;
+
+public:
+    json_value() = default;
+    json_value(bool b) : type{json_type::bool_j}, boolean{b} {}
+    json_value(int n) : type{json_type::number_j}, number(n) {}
+    json_value(double n) : type{json_type::number_j}, number{n} {}
+    json_value(std::string s) : type{json_type::string_j}, text{std::move(s)} {}
+    json_value(const char* s) : type{json_type::string_j}, text{s} {}
+
+    static json_value array()
+    {
+        json_value v;
+        v.type = json_type::array_j;
+        return v;
+    }
+    static json_value object()
+    {
+        json_value v;
+        v.type = json_type::object_j;
+        return v;
+    }
+    static json_value parse(const std::string& in); //throws std::runtime_error on malformed json
+
+    json_type return_type() const
+    {
+        return type;
+    }
+    bool is_null() const
+    {
+        return type == json_type::null_j;
+    }
+    const json_value& operator[](const std::string& key) const;
+    const json_value& operator[](size_t i) const;
+    size_t size() const
+    {
+        return type == json_type::array_j ? items.size() : members.size();
+    }
+    std::string as_string() const
+    {
+        return type == json_type::string_j ? text : "";
+    }
+    int as_int() const
+    {
+        return type == json_type::number_j ? (int)number : 0;
+    }
+
+    json_value& set(const std::string& key, json_value v); //adds or replaces a member, returns the object for chaining
+    json_value& push_back(json_value v);
+    std::string dump() const;
+};
@@ -0,0 +1,737 @@
+#include "lsp_server.h"
+#include "jack_tokenizer.h"
+#include "symbol_table.h"
+#include "char_scan.h"
+#include "async_io.h"
+#include <iostream>
+#include <filesystem>
+#include <chrono>
+#include <stdexcept>
+#include <unistd.h>
+#include <cctype>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+using tokenizer::token;
+using tokenizer::token_type;
+
+// protocol CompletionItemKind values
+const int method_item = 2;
+const int function_item = 3;
+const int constructor_item = 4;
+const int field_item = 5;
+const int variable_item = 6;
+const int class_item = 7;
+
+static std::string uri_to_path(const std::string& uri) //file:///a%20b/Main.jack -> /a b/Main.jack
+{
+    std::string path = uri.compare(0, 7, "file://") == 0 ? uri.substr(7) : uri;
+    std::string decoded;
+    for(size_t i = 0; i < path.size(); i++)
+    {
+        if(path[i] == '%' && i + 2 < path.size() && std::isxdigit((unsigned char)path[i + 1]) && std::isxdigit((unsigned char)path[i + 2])) //a % without two hex digits stays as it is
+        {
+            decoded += (char)std::stoi(path.substr(i + 1, 2), nullptr, 16);
+            i += 2;
+        }
+        else
+        {
+            decoded += path[i];
+        }
+    }
+    return decoded.empty() ? decoded : fs::path(decoded).lexically_normal().string();
+}
+
+static std::string path_to_uri(const std::string& path)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string uri = "file://";
+    for(unsigned char c : path)
+    {
+        if(std::isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~')
+        {
+            uri += c;
+        }
+        else
+        {
+            uri += '%';
+            uri += hex[c >> 4];
+            uri += hex[c & 15];
+        }
+    }
+    return uri;
+}
+
+static size_t word_start(const std::string& text, size_t at)
+{
+    while(at > 0 && (tokenizer::char_class_of(text[at - 1]) & tokenizer::IDENT_CHAR))
+    {
+        at--;
+    }
+    return at;
+}
+
+static int find_column(const std::string& text, const std::string& name) //first place name stands as a word of its own
+{
+    for(size_t at = text.find(name); at != std::string::npos; at = text.find(name, at + 1))
+    {
+        size_t end = at + name.size();
+        if(word_start(text, at) == at && (end == text.size() || !(tokenizer::char_class_of(text[end]) & tokenizer::IDENT_CHAR)))
+        {
+            return at;
+        }
+    }
+    return 0;
+}
+
+static json_value position(int line, int character)
+{
+    return json_value::object().set("line", line).set("character", character);
+}
+
+static json_value location(const std::string& path, int line, int character, int length)
+{
+    json_value range = json_value::object().set("start", position(line, character)).set("end", position(line, character + length));
+    return json_value::object().set("uri", path_to_uri(path)).set("range", range);
+}
+
+//==================================================================================================================================================================
+int lsp_server::run()
+{
+    out_fd = dup(1);
+    dup2(2, 1);
+    std::string body;
+    while(read_message(body))
+    {
+        json_value message;
+        try
+        {
+            message = json_value::parse(body);
+        }
+        catch(const std::runtime_error& e)
+        {
+            json_value error = json_value::object().set("code", -32700).set("message", e.what());
+            send(json_value::object().set("jsonrpc", "2.0").set("id", json_value{}).set("error", error));
+            continue;
+        }
+        std::string method = message["method"].as_string();
+        if(method == "exit")
+        {
+            return shutting_down ? 0 : 1;
+        }
+        auto started = std::chrono::steady_clock::now();
+        try
+        {
+            handle(message);
+        }
+        catch(const std::exception& e) //a source that went away while it was being read, or a request the handlers didn't expect
+        {
+            std::cerr << "lsp: " << method << ": " << e.what() << std::endl;
+        }
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+        if(ms > latency_budget_ms)
+        {
+            std::cerr << "lsp: " << method << " took " << ms << " ms" << std::endl;
+        }
+    }
+    return 1; //the client went away without exit
+}
+
+bool lsp_server::read_message(std::string& body) //Content-Length: n, a blank line, then n bytes of json
+{
+    std::string header;
+    long long length = -1;
+    while(std::getline(std::cin, header))
+    {
+        if(!header.empty() && header.back() == '\r')
+        {
+            header.pop_back();
+        }
+        if(header.empty())
+        {
+            if(length < 0)
+            {
+                continue;
+            }
+            body.resize(length);
+            return bool(std::cin.read(&body[0], length));
+        }
+        if(header.compare(0, 15, "Content-Length:") == 0)
+        {
+            length = std::atoll(header.c_str() + 15);
+        }
+    }
+    return false;
+}
+
+void lsp_server::send(const json_value& message)
+{
+    std::string body = message.dump();
+    std::string out = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    for(size_t written = 0; written < out.size();)
+    {
+        ssize_t n = write(out_fd, out.data() + written, out.size() - written);
+        if(n <= 0)
+        {
+            return;
+        }
+        written += n;
+    }
+}
+
+void lsp_server::handle(const json_value& message)
+{
+    std::string method = message["method"].as_string();
+    const json_value& params = message["params"];
+    json_value result;
+    bool known = true;
+    if(method == "initialize")
+    {
+        root = uri_to_path(params["rootUri"].as_string());
+        if(root == "")
+        {
+            root = params["rootPath"].as_string();
+        }
+        load_workspace();
+        json_value sync = json_value::object().set("openClose", true).set("change", 1).set("save", json_value::object().set("includeText", false));
+        json_value capabilities = json_value::object().set("textDocumentSync", sync).set("hoverProvider", true).set("definitionProvider", true)
+                                  .set("completionProvider", json_value::object().set("triggerCharacters", json_value::array().push_back(".")));
+        result = json_value::object().set("capabilities", capabilities).set("serverInfo", json_value::object().set("name", "jack"));
+    }
+    else if(method == "shutdown")
+    {
+        shutting_down = true;
+    }
+    else if(method == "textDocument/didOpen")
+    {
+        jack_document& doc = document(uri_to_path(params["textDocument"]["uri"].as_string()));
+        doc.open = true;
+        update(doc, split_source_lines(params["textDocument"]["text"].as_string()));
+    }
+    else if(method == "textDocument/didChange") //full text sync, the last change holds the whole document
+    {
+        const json_value& changes = params["contentChanges"];
+        if(changes.size() > 0)
+        {
+            update(document(uri_to_path(params["textDocument"]["uri"].as_string())), split_source_lines(changes[changes.size() - 1]["text"].as_string()));
+        }
+    }
+    else if(method == "textDocument/didClose")
+    {
+        jack_document& doc = document(uri_to_path(params["textDocument"]["uri"].as_string()));
+        doc.open = false;
+        doc.session = class_session{options};
+        publish_diagnostics(doc);
+        if(fs::exists(doc.path))
+        {
+            update(doc, read_source_lines(doc.path)); //the editor may have dropped unsaved changes
+        }
+    }
+    else if(method == "textDocument/didSave" || method == "workspace/didChangeWatchedFiles")
+    {
+        const json_value& changes = params["changes"];
+        for(size_t i = 0; i < changes.size(); i++)
+        {
+            jack_document& doc = document(uri_to_path(changes[i]["uri"].as_string()));
+            if(doc.open)
+            {
+                continue;
+            }
+            if(fs::exists(doc.path))
+            {
+                update(doc, read_source_lines(doc.path));
+            }
+            else
+            {
+                auto declared = classes.find(doc.class_name);
+                if(declared != classes.end() && declared->second == &doc)
+                {
+                    classes.erase(declared);
+                }
+                documents.erase(doc.path);
+            }
+        }
+        build_signatures();
+        for(auto& it : documents)
+        {
+            if(it.second.open)
+            {
+                update(it.second, it.second.lines); //only subroutines calling a changed signature compile again
+            }
+        }
+    }
+    else if(method == "textDocument/hover")
+    {
+        result = hover(params);
+    }
+    else if(method == "textDocument/definition")
+    {
+        result = definition(params);
+    }
+    else if(method == "textDocument/completion")
+    {
+        result = completion(params);
+    }
+    else
+    {
+        known = method == "initialized" || method.compare(0, 2, "$/") == 0;
+    }
+
+    const json_value& id = message["id"];
+    if(id.is_null())
+    {
+        return; //a notification
+    }
+    json_value response = json_value::object().set("jsonrpc", "2.0").set("id", id);
+    if(known)
+    {
+        response.set("result", result);
+    }
+    else
+    {
+        response.set("error", json_value::object().set("code", -32601).set("message", "Method not found: " + method));
+    }
+    send(response);
+}
+
+void lsp_server::load_workspace() //every .jack file of the workspace directory, the way the compiler finds them
+{
+    std::error_code ec;
+    for(const auto& entry : fs::directory_iterator(root == "" ? "." : root, ec))
+    {
+        if(entry.path().extension() == ".jack")
+        {
+            update(document(entry.path().lexically_normal().string()), read_source_lines(entry.path().string()));
+        }
+    }
+    build_signatures();
+}
+
+void lsp_server::build_signatures()
+{
+    std::vector<std::string> paths;
+    for(const auto& it : documents)
+    {
+        paths.push_back(it.first);
+    }
+    signatures = signature_index{};
+    signatures.build(paths, (root == "" ? std::string(".") : root) + "/.jack_signatures");
+}
+
+jack_document& lsp_server::document(const std::string& path)
+{
+    jack_document& doc = documents[path];
+    if(doc.path == "")
+    {
+        doc.path = path;
+        doc.session = class_session{options};
+    }
+    return doc;
+}
+
+void lsp_server::update(jack_document& doc, std::vector<std::string> lines)
+{
+    if(!shift_index(doc, lines))
+    {
+        doc.lines = std::move(lines);
+        index(doc);
+    }
+    else
+    {
+        doc.lines = std::move(lines);
+    }
+    if(doc.open)
+    {
+        doc.session.compile(doc.lines, &signatures);
+        publish_diagnostics(doc);
+    }
+}
+
+// most edits are to the statements of one subroutine and leave every declaration where it was, or only move those
+// below it by the lines inserted. an edit inside a body with no braces, var, string or comment delimiter on the
+// lines it changes is taken as one of those, anything else lexes the whole source again
+bool lsp_server::shift_index(jack_document& doc, const std::vector<std::string>& lines)
+{
+    int old_size = doc.lines.size(), new_size = lines.size();
+    int first_changed = 0;
+    while(first_changed < old_size && first_changed < new_size && doc.lines[first_changed] == lines[first_changed])
+    {
+        first_changed++;
+    }
+    int same_after = 0;
+    while(same_after < old_size - first_changed && same_after < new_size - first_changed && doc.lines[old_size - 1 - same_after] == lines[new_size - 1 - same_after])
+    {
+        same_after++;
+    }
+    int old_end = old_size - same_after, new_end = new_size - same_after;
+    int delta = new_size - old_size;
+    auto structural = [](const std::string& text)
+    {
+        size_t var = text.find("var");
+        return text.find_first_of("{}\"") != std::string::npos || text.find("/*") != std::string::npos || text.find("*/") != std::string::npos ||
+               (var != std::string::npos && word_start(text, var + 3) == var);
+    };
+    for(int i = first_changed; i < old_end; i++)
+    {
+        if(structural(doc.lines[i]))
+        {
+            return false;
+        }
+    }
+    for(int i = first_changed; i < new_end; i++)
+    {
+        if(structural(lines[i]))
+        {
+            return false;
+        }
+    }
+    const declaration* body = nullptr;
+    for(const declaration& d : doc.members)
+    {
+        if(d.item_kind != field_item && d.first_line < first_changed && old_end <= d.last_line && first_changed <= d.last_line)
+        {
+            body = &d;
+        }
+    }
+    if(body == nullptr)
+    {
+        return first_changed == old_end && first_changed == new_end; //nothing changed
+    }
+    auto shift = [first_changed, delta](declaration& d)
+    {
+        d.line += d.line >= first_changed ? delta : 0;
+        d.first_line += d.first_line >= first_changed ? delta : 0;
+        d.last_line += d.last_line >= first_changed ? delta : 0;
+    };
+    std::for_each(doc.members.begin(), doc.members.end(), shift);
+    std::for_each(doc.locals.begin(), doc.locals.end(), shift);
+    doc.class_line += doc.class_line >= first_changed ? delta : 0;
+    return true;
+}
+
+// the declarations of a source, read from its tokens: class variables, subroutines with their parameters and the
+// vars of their bodies, which are visible from the subroutine's first line to the line of its closing brace
+void lsp_server::index(jack_document& doc)
+{
+    auto it = classes.find(doc.class_name);
+    if(it != classes.end() && it->second == &doc)
+    {
+        classes.erase(it);
+    }
+    doc.class_name.clear();
+    doc.members.clear();
+    doc.locals.clear();
+
+    tokenizer::jack_tokenizer tokens;
+    tokens.lex_range(doc.lines, 0, doc.lines.size()); //a comment left open only loses what follows it
+    auto tok = [&tokens](int k)
+    {
+        return tokens.peek_token(k);
+    };
+    auto is = [&tokens](int k, const char* text)
+    {
+        const token* t = tokens.peek_token(k);
+        return t != nullptr && t->type != token_type::STRING_CONST && t->token_name == text;
+    };
+    auto is_name = [&tokens](int k)
+    {
+        const token* t = tokens.peek_token(k);
+        return t != nullptr && t->type == token_type::IDENTIFIER;
+    };
+    auto declare = [&doc](std::vector<declaration>& into, const token* t, const std::string& type, const std::string& detail, int item_kind)
+    {
+        declaration d;
+        d.name = t->token_name;
+        d.type = type;
+        d.detail = detail;
+        d.line = t->line_num - 1;
+        d.character = d.line < (int)doc.lines.size() ? find_column(doc.lines[d.line], d.name) : 0;
+        d.first_line = 0;
+        d.last_line = doc.lines.size();
+        d.item_kind = item_kind;
+        into.push_back(d);
+    };
+
+    if(!is(0, "class") || !is_name(1))
+    {
+        return;
+    }
+    doc.class_name = tok(1)->token_name;
+    doc.class_line = tok(1)->line_num - 1;
+    doc.class_character = doc.class_line < (int)doc.lines.size() ? find_column(doc.lines[doc.class_line], doc.class_name) : 0;
+    classes.emplace(doc.class_name, &doc);
+
+    for(int k = 2; tok(k) != nullptr;)
+    {
+        if(is(k, "static") || is(k, "field"))
+        {
+            std::string kind_name = tok(k)->token_name;
+            std::string type = tok(k + 1) != nullptr ? tok(k + 1)->token_name : "";
+            for(k += 2; tok(k) != nullptr && !is(k, ";") && !is(k, "}"); k++)
+            {
+                if(is_name(k))
+                {
+                    declare(doc.members, tok(k), type, kind_name + " " + type + " " + tok(k)->token_name, field_item);
+                }
+            }
+        }
+        else if(is(k, "constructor") || is(k, "function") || is(k, "method"))
+        {
+            std::string kind_name = tok(k)->token_name;
+            int item_kind = kind_name == "method" ? method_item : kind_name == "function" ? function_item : constructor_item;
+            if(tok(k + 1) == nullptr || !is_name(k + 2))
+            {
+                k++;
+                continue;
+            }
+            std::string return_type = tok(k + 1)->token_name;
+            const token* name = tok(k + 2);
+            size_t first_local = doc.locals.size();
+            int first_line = tok(k)->line_num - 1;
+            std::string parameters;
+            k += 3;
+            if(is(k, "("))
+            {
+                for(k++; tok(k) != nullptr && !is(k, ")") && !is(k, "{"); k++)
+                {
+                    if(is_name(k + 1) && !is(k, ","))
+                    {
+                        std::string type = tok(k)->token_name;
+                        declare(doc.locals, tok(k + 1), type, std::string(kind_str[kind::arg_k]) + " " + type + " " + tok(k + 1)->token_name, variable_item);
+                        parameters += (parameters.empty() ? "" : ", ") + type + " " + tok(k + 1)->token_name;
+                        k++;
+                    }
+                }
+            }
+            declare(doc.members, name, return_type, kind_name + " " + return_type + " " + name->token_name + "(" + parameters + ")", item_kind);
+            declaration& subroutine = doc.members.back();
+            while(tok(k) != nullptr && !is(k, "{"))
+            {
+                k++;
+            }
+            for(int depth = 0; tok(k) != nullptr; k++)
+            {
+                depth += is(k, "{") - is(k, "}");
+                if(depth == 0)
+                {
+                    break;
+                }
+                if(is(k, "var"))
+                {
+                    std::string type = tok(k + 1) != nullptr ? tok(k + 1)->token_name : "";
+                    for(k += 2; tok(k) != nullptr && !is(k, ";") && !is(k, "}"); k++)
+                    {
+                        if(is_name(k))
+                        {
+                            declare(doc.locals, tok(k), type, std::string(kind_str[kind::var_k]) + " " + type + " " + tok(k)->token_name, variable_item);
+                        }
+                    }
+                }
+            }
+            int last_line = tok(k) != nullptr ? tok(k)->line_num - 1 : doc.lines.size();
+            subroutine.first_line = first_line;
+            subroutine.last_line = last_line;
+            for(size_t i = first_local; i < doc.locals.size(); i++)
+            {
+                doc.locals[i].first_line = first_line;
+                doc.locals[i].last_line = last_line;
+            }
+        }
+        k++;
+    }
+}
+
+void lsp_server::publish_diagnostics(jack_document& doc)
+{
+    json_value diagnostics = json_value::array();
+    if(doc.open)
+    {
+        for(const syntax_error& e : doc.session.return_errors())
+        {
+            int line = std::max(0, std::min<int>(e.line - 1, (int)doc.lines.size() - 1));
+            int length = line < (int)doc.lines.size() ? doc.lines[line].size() : 0;
+            json_value range = json_value::object().set("start", position(line, 0)).set("end", position(line, length));
+            diagnostics.push_back(json_value::object().set("range", range).set("severity", 1).set("source", "jack").set("message", e.what + std::to_string(e.line)));
+        }
+    }
+    json_value params = json_value::object().set("uri", path_to_uri(doc.path)).set("diagnostics", diagnostics);
+    send(json_value::object().set("jsonrpc", "2.0").set("method", "textDocument/publishDiagnostics").set("params", params));
+}
+
+std::string lsp_server::type_of(const jack_document& doc, const std::string& name, int line) const //"" when name isn't a variable there
+{
+    for(const declaration& d : doc.locals)
+    {
+        if(d.name == name && line >= d.first_line && line <= d.last_line)
+        {
+            return d.type;
+        }
+    }
+    for(const declaration& d : doc.members)
+    {
+        if(d.name == name && d.item_kind == field_item)
+        {
+            return d.type;
+        }
+    }
+    return "";
+}
+
+const jack_document* lsp_server::find_class(const std::string& name) const
+{
+    auto it = classes.find(name);
+    return it == classes.end() ? nullptr : it->second;
+}
+
+// the declaration of the name under the cursor: after a dot the subroutine of the class before it, or of the
+// variable's class, otherwise the innermost local, then the class's own members, then a class. decl is left null
+// when the name is a class
+bool lsp_server::resolve(const jack_document& doc, int line, int character, const jack_document*& where, const declaration*& decl) const
+{
+    if(line < 0 || line >= (int)doc.lines.size())
+    {
+        return false;
+    }
+    const std::string& text = doc.lines[line];
+    size_t at = std::min<size_t>(std::max(character, 0), text.size());
+    size_t begin = word_start(text, at), end = at;
+    while(end < text.size() && (tokenizer::char_class_of(text[end]) & tokenizer::IDENT_CHAR))
+    {
+        end++;
+    }
+    if(begin == end)
+    {
+        return false;
+    }
+    std::string word = text.substr(begin, end - begin);
+    decl = nullptr;
+    if(begin > 0 && text[begin - 1] == '.')
+    {
+        std::string qualifier = text.substr(word_start(text, begin - 1), begin - 1 - word_start(text, begin - 1));
+        std::string class_nm = type_of(doc, qualifier, line);
+        where = find_class(class_nm == "" ? qualifier : class_nm);
+        if(where == nullptr)
+        {
+            return false;
+        }
+        for(const declaration& d : where->members)
+        {
+            if(d.name == word && d.item_kind != field_item)
+            {
+                decl = &d;
+                return true;
+            }
+        }
+        return false;
+    }
+    where = &doc;
+    for(const declaration& d : doc.locals)
+    {
+        if(d.name == word && line >= d.first_line && line <= d.last_line)
+        {
+            decl = &d;
+            return true;
+        }
+    }
+    for(const declaration& d : doc.members)
+    {
+        if(d.name == word)
+        {
+            decl = &d;
+            return true;
+        }
+    }
+    where = find_class(word);
+    return where != nullptr;
+}
+
+json_value lsp_server::hover(const json_value& params)
+{
+    const jack_document* where = nullptr;
+    const declaration* decl = nullptr;
+    auto it = documents.find(uri_to_path(params["textDocument"]["uri"].as_string()));
+    if(it == documents.end() || !resolve(it->second, params["position"]["line"].as_int(), params["position"]["character"].as_int(), where, decl))
+    {
+        return json_value{};
+    }
+    std::string text = decl != nullptr ? decl->detail : "class " + where->class_name;
+    if(decl != nullptr && decl->item_kind != variable_item)
+    {
+        text = where->class_name + ": " + text;
+    }
+    return json_value::object().set("contents", json_value::object().set("kind", "plaintext").set("value", text));
+}
+
+json_value lsp_server::definition(const json_value& params)
+{
+    const jack_document* where = nullptr;
+    const declaration* decl = nullptr;
+    auto it = documents.find(uri_to_path(params["textDocument"]["uri"].as_string()));
+    if(it == documents.end() || !resolve(it->second, params["position"]["line"].as_int(), params["position"]["character"].as_int(), where, decl))
+    {
+        return json_value{};
+    }
+    if(decl == nullptr)
+    {
+        return location(where->path, where->class_line, where->class_character, where->class_name.size());
+    }
+    return location(where->path, decl->line, decl->character, decl->name.size());
+}
+
+// after a dot the subroutines of that class, otherwise the locals in scope, the members of the class and every
+// class, all starting with what is typed before the cursor
+json_value lsp_server::completion(const json_value& params)
+{
+    json_value items = json_value::array();
+    auto it = documents.find(uri_to_path(params["textDocument"]["uri"].as_string()));
+    int line = params["position"]["line"].as_int();
+    if(it == documents.end() || line < 0 || line >= (int)it->second.lines.size())
+    {
+        return items;
+    }
+    const jack_document& doc = it->second;
+    const std::string& text = doc.lines[line];
+    size_t at = std::min<size_t>(std::max(params["position"]["character"].as_int(), 0), text.size());
+    size_t begin = word_start(text, at);
+    std::string prefix = text.substr(begin, at - begin);
+    auto offer = [&items, &prefix](const std::string& label, int item_kind, const std::string& detail)
+    {
+        if(label.compare(0, prefix.size(), prefix) == 0)
+        {
+            items.push_back(json_value::object().set("label", label).set("kind", item_kind).set("detail", detail));
+        }
+    };
+    if(begin > 0 && text[begin - 1] == '.')
+    {
+        std::string qualifier = text.substr(word_start(text, begin - 1), begin - 1 - word_start(text, begin - 1));
+        std::string class_nm = type_of(doc, qualifier, line);
+        const jack_document* target = find_class(class_nm == "" ? qualifier : class_nm);
+        if(target != nullptr)
+        {
+            for(const declaration& d : target->members)
+            {
+                if(d.item_kind != field_item)
+                {
+                    offer(d.name, d.item_kind, d.detail);
+                }
+            }
+        }
+        return items;
+    }
+    for(const declaration& d : doc.locals)
+    {
+        if(line >= d.first_line && line <= d.last_line)
+        {
+            offer(d.name, d.item_kind, d.detail);
+        }
+    }
+    for(const declaration& d : doc.members)
+    {
+        offer(d.name, d.item_kind, d.detail);
+    }
+    for(const auto& c : classes)
+    {
+        offer(c.first, class_item, "class " + c.first);
+    }
+    return items;
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include "json.h"
+#include "class_session.h"
+#include "signature_index.h"
+#include "compile_options.h"
+
+/*
+A language server speaking the language server protocol over stdin and stdout, started with --lsp. Every source in
+the workspace directory is indexed when the client initializes, open documents are indexed again on every change
+and compiled in their class_session, so an edit compiles only the subroutines it touched and its diagnostics are
+published as soon as it is done. Hover, definition and completion are answered from the declarations in memory.
+
+The compiler prints as it goes, so stdout is pointed at stderr while the server runs and the protocol goes out
+on a duplicate of the original stdout. Calls into other classes are checked against the signatures of the sources
+as saved, the index is built again when a source is saved or changes on disk.
+*/
+
+struct declaration //a name a source declares
+{
+    std::string name;
+    std::string type; //of a variable, the return type of a subroutine
+    std::string detail; //how it reads in a hover, like "field int x" or "method void move(int dx)"
+    int line = 0; //of the name, lines and characters count from 0 like the protocol's
+    int character = 0;
+    int first_line = 0; //lines an argument or local is visible on, a subroutine's own lines
+    int last_line = 0;
+    int item_kind = 0; //its protocol CompletionItemKind
+};
+
+struct jack_document //one source, open in the editor or only read from disk
+{
+    std::string path;
+    std::vector<std::string> lines;
+    std::string class_name;
+    int class_line = 0;
+    int class_character = 0;
+    std::vector<declaration> members; //fields, statics and subroutines
+    std::vector<declaration> locals; //arguments and vars of every subroutine
+    bool open = false;
+    class_session session;
+};
+
+class lsp_server
+{
+    compile_options options;
+    std::string root; //workspace directory
+    std::map<std::string,jack_document> documents; //by path, the nodes never move so classes can point into it
+    std::unordered_map<std::string,jack_document*> classes; //by class name, the first source declaring a class wins
+    signature_index signatures;
+    int out_fd = 1;
+    bool shutting_down = false;
+    static const int latency_budget_ms = 10; //requests slower than this are logged on stderr
+
+    bool read_message(std::string& body);
+    void send(const json_value& message);
+    void handle(const json_value& message);
+    void load_workspace();
+    void build_signatures();
+    jack_document& document(const std::string& path);
+    void update(jack_document& doc, std::vector<std::string> lines);
+    void index(jack_document& doc);
+    bool shift_index(jack_document& doc, const std::vector<std::string>& lines);
+    void publish_diagnostics(jack_document& doc);
+    std::string type_of(const jack_document& doc, const std::string& name, int line) const;
+    const jack_document* find_class(const std::string& name) const;
+    bool resolve(const jack_document& doc, int line, int character, const jack_document*& where, const declaration*& decl) const;
+    json_value hover(const json_value& params);
+    json_value definition(const json_value& params);
+    json_value completion(const json_value& params);
+
+public:
+    lsp_server(compile_options opts = {}) : options{opts}
+    {
+        options.trace = false; //the parser's trace would go to the client's log on every edit
+    }
+    int run(); //serves requests until the client says exit, returns the process exit code
+};
@@ -0,0 +1,55 @@
+#include "parse_stack.h"
+#include <pthread.h>
+#include <exception>
+
+
+struct parse_task
+{
+    const std::function<void()>* task;
+    std::exception_ptr thrown;
+};
+
+static void* run_task(void* arg)
+{
+    parse_task* t = static_cast<parse_task*>(arg);
+    try
+    {
+        (*t->task)();
+    }
+    catch(...) //a thread can't let an exception out, it goes to whoever joins it
+    {
+        t->thrown = std::current_exception();
+    }
+    return nullptr;
+}
+
+bool run_on_parse_stacks(std::vector<std::function<void()>> tasks)
+{
+    std::vector<parse_task> runs;
+    for(const std::function<void()>& task : tasks)
+    {
+        runs.push_back(parse_task{&task, nullptr});
+    }
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, (size_t(parse_stack_levels) + 128) * parse_stack_bytes_per_level);
+    std::vector<pthread_t> threads(tasks.size());
+    size_t count = 0;
+    while(count < tasks.size() && pthread_create(&threads[count], &attr, run_task, &runs[count]) == 0)
+    {
+        count++;
+    }
+    for(size_t i = 0; i < count; i++)
+    {
+        pthread_join(threads[i], nullptr);
+    }
+    pthread_attr_destroy(&attr);
+    for(const parse_task& t : runs)
+    {
+        if(t.thrown)
+        {
+            std::rethrow_exception(t.thrown);
+        }
+    }
+    return count == tasks.size();
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+//the parser recurses once per nesting level of the source, so it runs on stacks of its own rather than on the 8 MB
+//stack of the main thread. a stack holds parse_stack_levels levels, the parser carries on on a fresh one every
+//parse_stack_levels levels, so nesting is only bounded by memory and a level costs the same however deep it is.
+//the stacks are mapped memory, pages are only committed as deep code actually uses them
+
+const int parse_stack_levels = 1000;
+const size_t parse_stack_bytes_per_level = 8 << 10; //the largest frames of one term or block level, unoptimised builds included
+
+//runs each task on a stack of its own and returns when all are done, what a task throws is thrown again on the calling
+//thread. false when a stack couldn't be had, the tasks that did get one have finished
+bool run_on_parse_stacks(std::vector<std::function<void()>> tasks);
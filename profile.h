@@ -0,0 +1,96 @@
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+
+/*
+Execution counts written by --profile-generate and read by --profile-use. Everything is keyed by
+Class.subroutine names so the counts of one subroutine stay valid when other subroutines change.
+
+File format, one record per line:
+function <Class.sub> <times called>
+call <Class.caller> <Class.callee> <n> <count>        n counts the calls to callee inside caller in source order
+branch <Class.sub> <n> <times true> <times false>    n counts the if statements inside the subroutine in source order
+*/
+
+struct branch_count
+{
+    long long true_count = 0;
+    long long false_count = 0;
+};
+
+struct profile_data
+{
+    std::map<std::string,long long> functions;
+    std::map<std::string,long long> calls; //"caller callee n"
+    std::map<std::string,branch_count> branches; //"subroutine n"
+
+    bool load(const std::string& file_name)
+    {
+        std::ifstream in(file_name);
+        if(!in.is_open())
+        {
+            return false;
+        }
+        std::string line;
+        while(std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            std::string record, name;
+            fields >> record >> name;
+            if(record == "function")
+            {
+                fields >> functions[name];
+            }
+            else if(record == "call")
+            {
+                std::string callee, n;
+                long long count = 0;
+                fields >> callee >> n >> count;
+                calls[name + " " + callee + " " + n] = count;
+            }
+            else if(record == "branch")
+            {
+                std::string n;
+                branch_count count;
+                fields >> n >> count.true_count >> count.false_count;
+                branches[name + " " + n] = count;
+            }
+        }
+        return true;
+    }
+
+    bool save(const std::string& file_name) const
+    {
+        std::ofstream out(file_name);
+        if(!out.is_open())
+        {
+            return false;
+        }
+        for(const auto& it : functions)
+        {
+            out << "function " << it.first << " " << it.second << "\n";
+        }
+        for(const auto& it : calls)
+        {
+            out << "call " << it.first << " " << it.second << "\n";
+        }
+        for(const auto& it : branches)
+        {
+            out << "branch " << it.first << " " << it.second.true_count << " " << it.second.false_count << "\n";
+        }
+        return true;
+    }
+
+    long long total_calls() const
+    {
+        long long total = 0;
+        for(const auto& it : calls)
+        {
+            total += it.second;
+        }
+        return total;
+    }
+};
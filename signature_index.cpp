@@ -0,0 +1,401 @@
+#include "signature_index.h"
+#include "char_scan.h"
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace fs = std::filesystem;
+using tokenizer::char_class_of;
+
+const uint64_t fnv_offset = 14695981039346656037ull;
+const uint64_t fnv_prime = 1099511628211ull;
+
+static uint64_t hash_line(uint64_t hash, const std::string& line) //the line and the line end it lost to getline
+{
+    for(char c : line)
+    {
+        hash = (hash ^ (unsigned char)c) * fnv_prime;
+    }
+    return (hash ^ (unsigned char)'\n') * fnv_prime;
+}
+
+//just enough of the lexer to find the declarations. it reads characters the way jack_tokenizer::get_char does,
+//so identifiers run on across line ends and comments end where the lexer ends them, but it never reports an error
+class header_scanner
+{
+    std::istream& in;
+    std::string line;
+    size_t pos = 0;
+    uint64_t hash = fnv_offset;
+
+    bool get_char(char& c) //false at the end of the file, empty lines are skipped
+    {
+        while(pos == line.size())
+        {
+            if(!std::getline(in, line))
+            {
+                line.clear();
+                pos = 0;
+                return false;
+            }
+            hash = hash_line(hash, line);
+            pos = 0;
+        }
+        c = line[pos++];
+        return true;
+    }
+
+    void skip_run(unsigned char cls, std::string* word) //the rest of an identifier or number, which may go on on the next line
+    {
+        while(true)
+        {
+            size_t start = pos;
+            while(pos < line.size() && (char_class_of(line[pos]) & cls))
+            {
+                pos++;
+            }
+            if(word != nullptr)
+            {
+                word->append(line, start, pos - start);
+            }
+            if(pos < line.size())
+            {
+                return;
+            }
+            char c;
+            if(!get_char(c))
+            {
+                return;
+            }
+            pos -= 1;
+            if(!(char_class_of(c) & cls))
+            {
+                return;
+            }
+        }
+    }
+
+    void skip_comment() //after /*, a * followed by / ends it
+    {
+        char c;
+        while(true)
+        {
+            pos = std::min(line.find('*', pos), line.size());
+            if(!get_char(c))
+            {
+                return;
+            }
+            if(c == '*' && (!get_char(c) || c == '/'))
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    std::string word; //the identifier or keyword just read, empty for any other token
+    char symbol = 0; //the symbol just read, 0 for constants
+
+    header_scanner(std::istream& source) : in{source} {}
+
+    bool next() //reads the next token, false at the end of the file
+    {
+        char c;
+        word.clear();
+        symbol = 0;
+        while(get_char(c))
+        {
+            unsigned char cls = char_class_of(c);
+            if(cls & tokenizer::SLASH_CHAR)
+            {
+                char d = 0;
+                bool more = get_char(d);
+                if(more && d == '/')
+                {
+                    pos = line.size();
+                    continue;
+                }
+                if(more && d == '*')
+                {
+                    skip_comment();
+                    continue;
+                }
+                if(more)
+                {
+                    pos -= 1;
+                }
+                symbol = c;
+                return true;
+            }
+            if(cls & tokenizer::IDENT_START)
+            {
+                word = c;
+                skip_run(tokenizer::IDENT_CHAR, &word);
+                return true;
+            }
+            if(cls & tokenizer::DIGIT_CHAR)
+            {
+                skip_run(tokenizer::DIGIT_CHAR, nullptr);
+                return true;
+            }
+            if(cls & tokenizer::QUOTE_CHAR)
+            {
+                while(get_char(c) && c != '"')
+                {
+                    pos = std::min(line.find('"', pos), line.size());
+                }
+                return true;
+            }
+            if(cls & tokenizer::SYMBOL_CHAR)
+            {
+                symbol = c;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool is(char s) const
+    {
+        return word.empty() && symbol == s;
+    }
+
+    uint64_t return_hash() //reads what is left of the file so the hash covers all of it
+    {
+        while(std::getline(in, line))
+        {
+            hash = hash_line(hash, line);
+        }
+        return hash;
+    }
+};
+
+uint64_t signature_index::hash_file(const std::string& path)
+{
+    std::ifstream in(path);
+    std::string line;
+    uint64_t hash = fnv_offset;
+    while(std::getline(in, line))
+    {
+        hash = hash_line(hash, line);
+    }
+    return hash;
+}
+
+// class name { (static | field) type name (, name)* ; ... (constructor | function | method) type name ( parameters ) { body } ... }
+// a source that goes wrong is left with the declarations read so far, the compiler reports its errors later
+void signature_index::scan_source(source_record& record, std::istream& in)
+{
+    header_scanner sc{in};
+    class_signature& cls = record.signature;
+    record.class_name.clear();
+    cls = class_signature{};
+    if(sc.next() && sc.word == "class" && sc.next() && !sc.word.empty())
+    {
+        record.class_name = sc.word;
+        if(!sc.next() || !sc.is('{'))
+        {
+            record.hash = sc.return_hash();
+            return;
+        }
+        while(sc.next())
+        {
+            if(sc.word == "static" || sc.word == "field")
+            {
+                int& count = sc.word == "static" ? cls.statics : cls.fields;
+                int names = 0;
+                while(sc.next() && !sc.is(';'))
+                {
+                    names += !sc.word.empty();
+                }
+                count += names - 1; //the first word is the type
+            }
+            else if(sc.word == "constructor" || sc.word == "function" || sc.word == "method")
+            {
+                subroutine_signature sub;
+                sub.kind = sc.word == "constructor" ? subroutine_type::constructor : sc.word == "function" ? subroutine_type::function : subroutine_type::method;
+                std::string name;
+                if(!sc.next() || sc.word.empty())
+                {
+                    break;
+                }
+                sub.return_type = sc.word;
+                if(!sc.next() || sc.word.empty())
+                {
+                    break;
+                }
+                name = sc.word;
+                if(!sc.next() || !sc.is('('))
+                {
+                    break;
+                }
+                int words = 0;
+                while(sc.next() && !sc.is(')'))
+                {
+                    words += !sc.word.empty();
+                }
+                sub.parameters = words / 2; //a type and a name each
+                cls.subroutines.emplace(name, sub);
+                if(!sc.next() || !sc.is('{'))
+                {
+                    break;
+                }
+                for(int depth = 1; depth > 0 && sc.next();)
+                {
+                    depth += sc.is('{') - sc.is('}');
+                }
+            }
+            else
+            {
+                break;
+            }
+        }
+    }
+    record.hash = sc.return_hash();
+}
+
+bool signature_index::load_cache(const std::string& cache_file, std::unordered_map<std::string,source_record>& records)
+{
+    std::ifstream in(cache_file);
+    if(!in.is_open())
+    {
+        return false;
+    }
+    std::string line;
+    source_record* current = nullptr;
+    while(std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        std::string record;
+        fields >> record;
+        if(record == "file")
+        {
+            source_record r;
+            fields >> r.size >> r.mtime >> r.hash;
+            fields.get();
+            std::getline(fields, r.path);
+            current = &(records[r.path] = r);
+        }
+        else if(record == "class" && current != nullptr)
+        {
+            fields >> current->class_name >> current->signature.fields >> current->signature.statics;
+        }
+        else if(record == "sub" && current != nullptr)
+        {
+            std::string name;
+            int kind = 0;
+            subroutine_signature sub;
+            fields >> name >> kind >> sub.parameters >> sub.return_type;
+            sub.kind = static_cast<subroutine_type>(kind);
+            current->signature.subroutines.emplace(name, sub);
+        }
+    }
+    return true;
+}
+
+void signature_index::save_cache(const std::string& cache_file, const std::vector<source_record>& records)
+{
+    std::ofstream out(cache_file);
+    if(!out.is_open())
+    {
+        return; //a read only directory only loses the cache
+    }
+    for(const source_record& r : records)
+    {
+        out << "file " << r.size << " " << r.mtime << " " << r.hash << " " << r.path << "\n";
+        if(r.class_name != "")
+        {
+            out << "class " << r.class_name << " " << r.signature.fields << " " << r.signature.statics << "\n";
+            for(const auto& it : r.signature.subroutines)
+            {
+                out << "sub " << it.first << " " << it.second.kind << " " << it.second.parameters << " " << it.second.return_type << "\n";
+            }
+        }
+    }
+}
+
+void signature_index::build(const std::vector<std::string>& file_names, const std::string& cache_file)
+{
+    std::unordered_map<std::string,source_record> cached;
+    load_cache(cache_file, cached);
+    std::vector<source_record> records(file_names.size());
+    std::atomic<size_t> next{0};
+    std::atomic<bool> changed{cached.size() != file_names.size()};
+    int threads = std::clamp<int>(std::thread::hardware_concurrency(), 1, std::max<int>(file_names.size(), 1));
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; t++)
+    {
+        workers.emplace_back([&]()
+        {
+            for(size_t i = next++; i < file_names.size(); i = next++)
+            {
+                source_record& r = records[i];
+                r.path = file_names[i];
+                std::error_code ec;
+                r.size = fs::file_size(r.path, ec);
+                r.mtime = fs::last_write_time(r.path, ec).time_since_epoch().count();
+                auto it = cached.find(r.path);
+                if(it != cached.end() && it->second.size == r.size && it->second.mtime == r.mtime)
+                {
+                    r = it->second;
+                    continue;
+                }
+                changed = true;
+                if(it != cached.end() && it->second.size == r.size && (r.hash = hash_file(r.path)) == it->second.hash) //only touched
+                {
+                    r.class_name = it->second.class_name;
+                    r.signature = it->second.signature;
+                    continue;
+                }
+                std::ifstream in(r.path);
+                scan_source(r, in);
+            }
+        });
+    }
+    for(std::thread& t : workers)
+    {
+        t.join();
+    }
+    for(const source_record& r : records)
+    {
+        hashes[r.path] = r.hash;
+        if(r.class_name != "")
+        {
+            classes.emplace(r.class_name, r.signature); //the first source declaring a class wins, like the symbol tables
+        }
+    }
+    if(changed)
+    {
+        save_cache(cache_file, records);
+    }
+}
+
+void signature_index::build_in_memory(const std::vector<std::string>& names, const std::vector<std::string>& sources)
+{
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        source_record r;
+        r.path = names[i];
+        std::istringstream in(sources[i]);
+        scan_source(r, in);
+        hashes[r.path] = r.hash;
+        if(r.class_name != "")
+        {
+            classes.emplace(r.class_name, r.signature);
+        }
+    }
+}
+
+std::string signature_index::describe(const std::string& class_nm, const std::string& subroutine_nm) const
+{
+    const class_signature* cls = find_class(class_nm);
+    const subroutine_signature* sub = cls != nullptr ? cls->find(subroutine_nm) : nullptr;
+    if(sub == nullptr)
+    {
+        return "-";
+    }
+    return std::to_string(sub->kind) + " " + std::to_string(sub->parameters) + " " + sub->return_type;
+}
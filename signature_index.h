@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <istream>
+
+/*
+Declarations of every class being compiled, read before any of them is compiled so a call into another class
+can be checked against the subroutine it names. Only class variable declarations and subroutine headers are
+scanned, subroutine bodies are skipped by counting braces.
+
+The signatures of each source are cached next to the sources, one record per line:
+file <size> <mtime> <hash> <path>     hash is fnv-1a of the file's lines
+class <name> <fields> <statics>
+sub <name> <kind> <parameters> <return type>
+a source whose size and mtime match its record is not read again, one whose hash still matches is not scanned
+*/
+
+enum subroutine_type
+{
+    constructor,function,method
+};
+
+struct subroutine_signature
+{
+    subroutine_type kind = subroutine_type::function;
+    int parameters = 0; //not counting this
+    std::string return_type;
+};
+
+struct class_signature
+{
+    int fields = 0;
+    int statics = 0;
+    std::unordered_map<std::string,subroutine_signature> subroutines;
+
+    const subroutine_signature* find(const std::string& name) const
+    {
+        auto it = subroutines.find(name);
+        return it == subroutines.end() ? nullptr : &it->second;
+    }
+};
+
+class signature_index
+{
+    struct source_record //what the cache keeps for one source
+    {
+        std::string path;
+        uintmax_t size = 0;
+        long long mtime = 0;
+        uint64_t hash = 0;
+        std::string class_name; //empty when the source doesn't start like a class
+        class_signature signature;
+    };
+    std::unordered_map<std::string,class_signature> classes;
+    std::unordered_map<std::string,uint64_t> hashes; //source path -> hash of its lines
+
+    static bool load_cache(const std::string& cache_file, std::unordered_map<std::string,source_record>& records);
+    static void save_cache(const std::string& cache_file, const std::vector<source_record>& records);
+    static void scan_source(source_record& record, std::istream& in);
+    static uint64_t hash_file(const std::string& path);
+
+public:
+    void build(const std::vector<std::string>& file_names, const std::string& cache_file); //scans the sources on one thread per core
+    void build_in_memory(const std::vector<std::string>& names, const std::vector<std::string>& sources); //sources held by the caller, nothing is read or cached
+    const class_signature* find_class(const std::string& name) const //nullptr for classes that aren't among the sources, like the os
+    {
+        auto it = classes.find(name);
+        return it == classes.end() ? nullptr : &it->second;
+    }
+    std::string describe(const std::string& class_nm, const std::string& subroutine_nm) const; //"kind parameters return type", "-" when either isn't declared
+    uint64_t hash_of(const std::string& path) const
+    {
+        auto it = hashes.find(path);
+        return it == hashes.end() ? 0 : it->second;
+    }
+};
@@ -1,7 +1,9 @@
 #pragma once
 #include<iostream>
-#include <unordered_map>
+#include <vector>
 #include <string>
+#include <functional>
+#include <algorithm>
 
 
 enum kind
@@ -18,13 +20,80 @@ struct symbol
     int num;
 };
 
+struct symbol_ref //result of a single lookup, type points into the table and stays valid until the next define
+{
+    bool found = false;
+    kind ki = kind::NONE;
+    int num = -1;
+    const std::string* type = nullptr;
+};
+
 
 
+//symbols live in a vector in definition order and are found through a small open addressing table of
+//indexes into it. start_subroutine only resets the counts, so the strings and both vectors keep their
+//memory from one subroutine to the next
 class symbol_table
 {
-    std::unordered_map<std::string,symbol> symbols;
-    std::unordered_map<kind,int> kind_count;
+    std::vector<symbol> symbols;
+    int used = 0; //symbols[0..used) are defined, the rest are kept for their string buffers
+    std::vector<int> slots = std::vector<int>(16, -1); //index into symbols or -1, size is a power of two
+    int kind_count[kind::NONE] = {};
     char table_type;
+
+    int find_slot(const std::string& str) const //slot holding str, or the empty slot where it would go
+    {
+        std::size_t mask = slots.size() - 1;
+        std::size_t i = std::hash<std::string>{}(str) & mask;
+        while(slots[i] != -1 && symbols[slots[i]].symbol_name != str)
+        {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void grow()
+    {
+        std::vector<int> old(slots.size() * 2, -1);
+        slots.swap(old);
+        for(int i = 0; i < used; i++)
+        {
+            slots[find_slot(symbols[i].symbol_name)] = i;
+        }
+    }
+
+    void add(const std::string& n, const std::string& t, kind k) //keeps the first definition of a name, like the map insert it replaces
+    {
+        int slot = find_slot(n);
+        if(slots[slot] == -1)
+        {
+            if(used == (int)symbols.size())
+            {
+                symbols.emplace_back();
+            }
+            symbol& sym = symbols[used];
+            sym.symbol_name.assign(n);
+            sym.type.assign(t);
+            sym.ki = k;
+            sym.num = kind_count[k];
+            slots[slot] = used++;
+            if(used * 2 > (int)slots.size())
+            {
+                grow();
+            }
+        }
+        kind_count[k]+=1;
+    }
+
+    void clear_symbols()
+    {
+        if(used > 0)
+        {
+            std::fill(slots.begin(), slots.end(), -1);
+            used = 0;
+        }
+    }
+
 public:
     symbol_table(char type)
     {
@@ -53,7 +122,7 @@ public:
         {
             kind_count[kind::arg_k] = 0;
             kind_count[kind::var_k] = 0;
-            symbols.clear();
+            clear_symbols();
         }
         else if(table_type == 'c')
         {
@@ -72,13 +141,11 @@ public:
         {
             if(k == kind::static_k)
             {
-                symbols.insert({n,symbol{n,t,k,kind_count[k]}});
-                kind_count[k]+=1;
+                add(n,t,k);
             }
             else if(k == kind::field_k)
             {
-                symbols.insert({n,symbol{n,t,k,kind_count[k]}});
-                kind_count[k]+=1;
+                add(n,t,k);
             }
             else
             {
@@ -92,13 +159,11 @@ public:
         {
             if(k == kind::var_k)
             {
-                symbols.insert({n,symbol{n,t,k,kind_count[k]}});
-                kind_count[k]+=1;
+                add(n,t,k);
             }
             else if(k == kind::arg_k)
             {
-                symbols.insert({n,symbol{n,t,k,kind_count[k]}});
-                kind_count[k] += 1;
+                add(n,t,k);
             }
             else
             {
@@ -137,41 +202,48 @@ public:
         }
     }
 
-    kind kind_of(std::string str)
+    symbol_ref resolve(const std::string& str) const //kind, index and type with one hash lookup
     {
-        return symbols[str].ki;
+        symbol_ref ref;
+        int index = slots[find_slot(str)];
+        if(index != -1)
+        {
+            const symbol& sym = symbols[index];
+            ref.found = true;
+            ref.ki = sym.ki;
+            ref.num = sym.num;
+            ref.type = &sym.type;
+        }
+        return ref;
     }
 
-
-    std::string type_of(std::string str)
+    kind kind_of(const std::string& str) const
     {
-        return symbols[str].type;
+        return resolve(str).ki;
     }
 
-    int index_of(std::string str)
+
+    std::string type_of(const std::string& str) const
     {
-        return symbols[str].num;
+        symbol_ref ref = resolve(str);
+        return ref.found ? *ref.type : "";
     }
 
-    bool symbol_exists_of(std::string str)
+    int index_of(const std::string& str) const
     {
-        std::unordered_map<std::string,symbol>::const_iterator got = symbols.find(str);
-        if(got == symbols.end())
-        {
-            return false;
-        }
-        else
-        {
-            return true;
-        }
+        return resolve(str).num;
+    }
 
+    bool symbol_exists_of(const std::string& str) const
+    {
+        return resolve(str).found;
     }
 
     void print_symbols()
     {
-        for (auto& it: symbols) {
-    // Do stuff
-            std::cout << it.first << " " << it.second.ki << " " << it.second.num << " " << it.second.symbol_name << " " << it.second.type << std::endl;
+        for (int i = 0; i < used; i++) {
+            const symbol& it = symbols[i];
+            std::cout << it.symbol_name << " " << it.ki << " " << it.num << " " << it.symbol_name << " " << it.type << std::endl;
         }
     }
 
@@ -0,0 +1,101 @@
+#include "jackc.h"
+#include "vm_interpreter.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <algorithm>
+
+/*
+Regression cases: every directory under tests/cases holds the .jack classes of one program and an expected file with
+what the program prints. Each case is compiled in memory with the default options and with --inline-intrinsics, run
+on the vm interpreter and its output compared with the expected file.
+
+From the top of the tree:
+    g++ -std=c++17 -O2 -pthread -I. tests/run_tests.cpp $(ls *.cpp | grep -v jack_compiler.cpp) -o run_tests
+    ./run_tests tests/cases
+*/
+
+namespace fs = std::filesystem;
+
+static std::string read_file(const fs::path& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    std::stringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+static bool run_case(const fs::path& dir, const compile_options& options, const std::string& variant)
+{
+    std::vector<std::string> names, sources;
+    for(const auto& entry : fs::directory_iterator(dir))
+    {
+        if(entry.path().extension() == ".jack")
+        {
+            names.push_back(entry.path().string());
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for(const std::string& name : names)
+    {
+        sources.push_back(read_file(name));
+    }
+    signature_index signatures;
+    signatures.build_in_memory(names, sources);
+
+    vm_interpreter vm;
+    for(size_t i = 0; i < names.size(); i++)
+    {
+        jackc::result r = jackc::compile(sources[i], options, &signatures);
+        if(!r.ok)
+        {
+            std::cout << "FAIL " << dir.string() << " " << variant << ": " << names[i] << " has syntax errors" << std::endl;
+            return false;
+        }
+        std::istringstream vm_code(r.vm);
+        vm.load(vm_code, names[i]);
+    }
+    std::ostringstream printed;
+    vm.print_to(&printed);
+    bool finished = vm.run(100000000);
+    std::string expected = read_file(dir / "expected");
+    if(!finished || printed.str() != expected)
+    {
+        std::cout << "FAIL " << dir.string() << " " << variant << ": printed \"" << printed.str() << "\", expected \"" << expected << "\"" << std::endl;
+        return false;
+    }
+    std::cout << "ok   " << dir.string() << " " << variant << std::endl;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2)
+    {
+        std::cerr << "Usage : ./run_tests cases_directory\n";
+        return 1;
+    }
+    std::vector<fs::path> cases;
+    for(const auto& entry : fs::directory_iterator(argv[1]))
+    {
+        if(entry.is_directory())
+        {
+            cases.push_back(entry.path());
+        }
+    }
+    std::sort(cases.begin(), cases.end());
+
+    compile_options plain, intrinsics;
+    plain.parse_tree = false; //only the vm code is run, the parse tree of the deep cases would take most of the time
+    intrinsics.parse_tree = false;
+    intrinsics.inline_intrinsics = true;
+    int failed = 0;
+    for(const fs::path& dir : cases)
+    {
+        failed += !run_case(dir, plain, "default");
+        failed += !run_case(dir, intrinsics, "inline-intrinsics");
+    }
+    std::cout << cases.size() << " cases, " << failed << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
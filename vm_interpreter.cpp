@@ -0,0 +1,416 @@
+#include "vm_interpreter.h"
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+
+bool vm_interpreter::load(const std::string& file_name)
+{
+    std::ifstream in(file_name);
+    if(!in.is_open())
+    {
+        return false;
+    }
+    return load(in, file_name);
+}
+
+bool vm_interpreter::load(std::istream& in, const std::string& file_name)
+{
+    int static_base = next_static;
+    int static_count = 0;
+    std::string current_function;
+    std::unordered_map<std::string,int> call_sites; //same numbering as vm_writer::write_call
+    int if_statements = 0;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        line = line.substr(0, line.find("//"));
+        std::istringstream fields(line);
+        std::string op, arg1;
+        int arg2 = 0;
+        if(!(fields >> op))
+        {
+            continue;
+        }
+        fields >> arg1 >> arg2;
+
+        instruction ins;
+        ins.static_base = static_base;
+        if(op == "push" || op == "pop")
+        {
+            ins.op = op == "push" ? vm_op::OP_PUSH : vm_op::OP_POP;
+            auto it = std::find(std::begin(segments_string), std::end(segments_string), arg1);
+            if(it == std::end(segments_string))
+            {
+                std::cerr << "Unknown segment " << arg1 << " in " << file_name << std::endl;
+                return false;
+            }
+            ins.seg_or_command = it - std::begin(segments_string);
+            ins.num = arg2;
+            if(ins.seg_or_command == segments::STATIC)
+            {
+                static_count = std::max(static_count, arg2 + 1);
+            }
+        }
+        else if(op == "label" || op == "goto" || op == "if-goto")
+        {
+            ins.op = op == "label" ? vm_op::OP_LABEL : (op == "goto" ? vm_op::OP_GOTO : vm_op::OP_IF);
+            ins.name = arg1;
+            // compile_if jumps to L<n>_initial when the condition is false, which is how if statements are told apart
+            if(ins.op == vm_op::OP_IF && arg1.size() > 8 && arg1.compare(arg1.size() - 8, 8, "_initial") == 0)
+            {
+                ins.key = current_function + " " + std::to_string(if_statements++);
+            }
+        }
+        else if(op == "call")
+        {
+            ins.op = vm_op::OP_CALL;
+            ins.name = arg1;
+            ins.num = arg2;
+            ins.key = current_function + " " + arg1 + " " + std::to_string(call_sites[arg1]++);
+        }
+        else if(op == "function")
+        {
+            ins.op = vm_op::OP_FUNCTION;
+            ins.name = arg1;
+            ins.num = arg2;
+            current_function = arg1;
+            call_sites.clear();
+            if_statements = 0;
+            functions[arg1] = code.size();
+        }
+        else if(op == "return")
+        {
+            ins.op = vm_op::OP_RETURN;
+        }
+        else
+        {
+            auto it = std::find(std::begin(command_string), std::end(command_string), op);
+            if(it == std::end(command_string))
+            {
+                std::cerr << "Unknown command " << op << " in " << file_name << std::endl;
+                return false;
+            }
+            ins.op = vm_op::OP_ARITHMETIC;
+            ins.seg_or_command = it - std::begin(command_string);
+        }
+        code.push_back(ins);
+    }
+    next_static += static_count;
+    return true;
+}
+
+void vm_interpreter::resolve() //labels are local to their function
+{
+    std::unordered_map<std::string,int> labels;
+    size_t function_start = 0;
+    for(size_t i = 0; i <= code.size(); i++)
+    {
+        if(i == code.size() || code[i].op == vm_op::OP_FUNCTION)
+        {
+            for(size_t j = function_start; j < i; j++)
+            {
+                if(code[j].op == vm_op::OP_GOTO || code[j].op == vm_op::OP_IF)
+                {
+                    code[j].target = labels.count(code[j].name) ? labels[code[j].name] : -1;
+                }
+            }
+            labels.clear();
+            function_start = i;
+        }
+        else if(code[i].op == vm_op::OP_LABEL)
+        {
+            labels[code[i].name] = i;
+        }
+    }
+    for(instruction& ins : code)
+    {
+        if(ins.op == vm_op::OP_CALL)
+        {
+            ins.target = functions.count(ins.name) ? functions[ins.name] : -1;
+        }
+    }
+}
+
+bool vm_interpreter::run(long long max_steps)
+{
+    resolve();
+    std::string entry = functions.count("Sys.init") ? "Sys.init" : "Main.main";
+    if(!functions.count(entry))
+    {
+        std::cerr << "No " << entry << " to run" << std::endl;
+        return false;
+    }
+
+    ram[0] = 256;
+    // the same frame a call would build, with a return address that ends the run
+    return_addresses.push_back(-1);
+    push(0); push(0); push(0); push(0); push(0);
+    ram[2] = ram[0] - 5;
+    ram[1] = ram[0];
+    int pc = functions[entry];
+    for(int i = 0; i < code[pc].num; i++)
+    {
+        push(0);
+    }
+    pc += 1;
+    profile.functions[entry] += 1;
+
+    while(!halted && pc >= 0)
+    {
+        if(++steps > max_steps)
+        {
+            error("step limit reached");
+            break;
+        }
+        const instruction& ins = code[pc];
+        pc += 1;
+        switch(ins.op)
+        {
+        case vm_op::OP_PUSH: case vm_op::OP_POP:
+        {
+            int address = 0;
+            switch(ins.seg_or_command)
+            {
+            case segments::CONST: address = -1; break;
+            case segments::LOCAL: address = ram[1] + ins.num; break;
+            case segments::ARG: address = ram[2] + ins.num; break;
+            case segments::THIS: address = (unsigned short)ram[3] + ins.num; break;
+            case segments::THAT: address = (unsigned short)ram[4] + ins.num; break;
+            case segments::POINTER: address = 3 + ins.num; break;
+            case segments::TEMP: address = 5 + ins.num; break;
+            case segments::STATIC: address = ins.static_base + ins.num; break;
+            }
+            if(ins.op == vm_op::OP_PUSH)
+            {
+                push(address == -1 ? ins.num : at(address));
+            }
+            else
+            {
+                at(address) = pop();
+            }
+            break;
+        }
+        case vm_op::OP_ARITHMETIC:
+        {
+            int y = pop();
+            switch(ins.seg_or_command)
+            {
+            case command::NEG: push(-y); break;
+            case command::NOT: push(~y); break;
+            default:
+            {
+                int x = pop();
+                switch(ins.seg_or_command)
+                {
+                case command::ADD: push(x + y); break;
+                case command::SUB: push(x - y); break;
+                case command::AND: push(x & y); break;
+                case command::OR: push(x | y); break;
+                case command::EQ: push(x == y ? -1 : 0); break;
+                case command::GT: push(x > y ? -1 : 0); break;
+                case command::LT: push(x < y ? -1 : 0); break;
+                }
+            }
+            }
+            break;
+        }
+        case vm_op::OP_LABEL: case vm_op::OP_FUNCTION:
+            break;
+        case vm_op::OP_GOTO:
+            pc = ins.target;
+            if(pc == -1)
+            {
+                error("Unknown label " + ins.name);
+            }
+            break;
+        case vm_op::OP_IF:
+        {
+            bool jump = pop() != 0;
+            if(ins.key != "")
+            {
+                branch_count& count = profile.branches[ins.key];
+                jump ? count.false_count++ : count.true_count++;
+            }
+            if(jump)
+            {
+                pc = ins.target;
+                if(pc == -1)
+                {
+                    error("Unknown label " + ins.name);
+                }
+            }
+            break;
+        }
+        case vm_op::OP_CALL:
+        {
+            profile.calls[ins.key] += 1;
+            if(ins.target == -1)
+            {
+                if(!call_builtin(ins.name, ins.num))
+                {
+                    error("Unknown subroutine " + ins.name);
+                }
+                break;
+            }
+            profile.functions[ins.name] += 1;
+            return_addresses.push_back(pc);
+            push(0); push(ram[1]); push(ram[2]); push(ram[3]); push(ram[4]);
+            ram[2] = ram[0] - 5 - ins.num;
+            ram[1] = ram[0];
+            for(int i = 0; i < code[ins.target].num; i++)
+            {
+                push(0);
+            }
+            pc = ins.target + 1;
+            break;
+        }
+        case vm_op::OP_RETURN:
+        {
+            int frame = ram[1];
+            int return_address = return_addresses.back();
+            return_addresses.pop_back();
+            ram[ram[2]] = pop();
+            ram[0] = ram[2] + 1;
+            ram[4] = ram[frame - 1];
+            ram[3] = ram[frame - 2];
+            ram[2] = ram[frame - 3];
+            ram[1] = ram[frame - 4];
+            pc = return_address;
+            break;
+        }
+        }
+    }
+    return !failed;
+}
+
+short& vm_interpreter::at(int address)
+{
+    if(address < 0 || address >= (int)ram.size())
+    {
+        error("Address out of range " + std::to_string(address));
+        return ram[0];
+    }
+    return ram[address];
+}
+
+void vm_interpreter::push(int value)
+{
+    ram[(unsigned short)ram[0]] = (short)value;
+    ram[0] += 1;
+}
+
+int vm_interpreter::pop()
+{
+    ram[0] -= 1;
+    return ram[(unsigned short)ram[0]];
+}
+
+void vm_interpreter::error(std::string what)
+{
+    std::cerr << "VM error: " << what << std::endl;
+    halted = true;
+    failed = true;
+}
+
+int vm_interpreter::alloc(int size)
+{
+    int address = heap_top;
+    heap_top += std::max(size, 1);
+    if(heap_top > 16384)
+    {
+        error("Heap overflow");
+    }
+    return address;
+}
+
+int vm_interpreter::new_string(int max_length) //max length, length, characters
+{
+    int str = alloc(max_length + 2);
+    ram[str] = max_length;
+    ram[str + 1] = 0;
+    return str;
+}
+
+bool vm_interpreter::call_builtin(const std::string& name, int num_of_args)
+{
+    std::vector<int> args(num_of_args);
+    for(int i = num_of_args - 1; i >= 0; i--)
+    {
+        args[i] = pop();
+    }
+    auto arg = [&](int i) { return i < num_of_args ? args[i] : 0; };
+    int result = 0;
+
+    if(name == "Memory.alloc" || name == "Array.new") result = alloc(arg(0));
+    else if(name == "Memory.deAlloc" || name == "Array.dispose" || name == "String.dispose") result = 0;
+    else if(name == "Memory.peek") result = at(arg(0));
+    else if(name == "Memory.poke") at(arg(0)) = arg(1);
+    else if(name == "Math.multiply") result = arg(0) * arg(1);
+    else if(name == "Math.divide")
+    {
+        if(arg(1) == 0)
+        {
+            error("Division by zero");
+            return true;
+        }
+        result = arg(0) / arg(1);
+    }
+    else if(name == "Math.abs") result = std::abs(arg(0));
+    else if(name == "Math.min") result = std::min(arg(0), arg(1));
+    else if(name == "Math.max") result = std::max(arg(0), arg(1));
+    else if(name == "Math.sqrt")
+    {
+        while((result + 1) * (result + 1) <= arg(0)) result++;
+    }
+    else if(name == "String.new") result = new_string(arg(0));
+    else if(name == "String.length") result = at(arg(0) + 1);
+    else if(name == "String.charAt") result = at(arg(0) + 2 + arg(1));
+    else if(name == "String.setCharAt") at(arg(0) + 2 + arg(1)) = arg(2);
+    else if(name == "String.appendChar")
+    {
+        at(arg(0) + 2 + at(arg(0) + 1)) = arg(1);
+        at(arg(0) + 1) += 1;
+        result = arg(0);
+    }
+    else if(name == "String.eraseLastChar") at(arg(0) + 1) -= 1;
+    else if(name == "String.intValue")
+    {
+        int str = arg(0), length = at(str + 1), i = 0;
+        bool negative = length > 0 && at(str + 2) == '-';
+        for(i = negative ? 1 : 0; i < length && at(str + 2 + i) >= '0' && at(str + 2 + i) <= '9'; i++)
+        {
+            result = result * 10 + at(str + 2 + i) - '0';
+        }
+        result = negative ? -result : result;
+    }
+    else if(name == "String.setInt")
+    {
+        std::string digits = std::to_string(arg(1));
+        at(arg(0) + 1) = digits.size();
+        for(size_t i = 0; i < digits.size(); i++)
+        {
+            at(arg(0) + 2 + i) = digits[i];
+        }
+    }
+    else if(name == "String.newLine") result = 128;
+    else if(name == "String.backSpace") result = 129;
+    else if(name == "String.doubleQuote") result = 34;
+    else if(name == "Output.printString")
+    {
+        for(int i = 0; i < at(arg(0) + 1); i++)
+        {
+            print(std::string(1, (char)at(arg(0) + 2 + i)));
+        }
+    }
+    else if(name == "Output.printInt") print(std::to_string((short)arg(0)));
+    else if(name == "Output.printChar") print(std::string(1, (char)arg(0)));
+    else if(name == "Output.println") print("\n");
+    else if(name == "Sys.halt") halted = true;
+    else if(name == "Sys.error") error("Sys.error " + std::to_string(arg(0)));
+    else if(name.rfind("Output.",0) == 0 || name.rfind("Screen.",0) == 0 || name.rfind("Keyboard.",0) == 0 || name == "Sys.wait") result = 0;
+    else return false;
+
+    push(result);
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "vm_writer.h"
+#include "profile.h"
+
+enum vm_op
+{
+    OP_PUSH,OP_POP,OP_ARITHMETIC,OP_LABEL,OP_GOTO,OP_IF,OP_CALL,OP_FUNCTION,OP_RETURN
+};
+
+//runs vm code with the same memory layout as the vm emulator and counts what --profile-generate needs.
+//os subroutines that are not loaded from a .vm file are replaced by small built in versions
+class vm_interpreter
+{
+    struct instruction
+    {
+        vm_op op;
+        int seg_or_command = 0; //segments for push/pop, command for arithmetic
+        int num = 0; //index, argument count or local count
+        int target = -1; //resolved jump target or callee, -1 for a built in callee
+        int static_base = 16;
+        std::string name; //label, callee or function name
+        std::string key; //profile key of calls and if statement branches, empty otherwise
+    };
+
+    std::vector<instruction> code;
+    std::unordered_map<std::string,int> functions;
+    std::vector<short> ram = std::vector<short>(32768, 0);
+    int next_static = 16;
+    int heap_top = 2048;
+    long long steps = 0;
+    bool halted = false;
+    bool failed = false;
+    std::vector<int> return_addresses; //kept beside the frames since code indexes do not fit in a ram word
+    std::ostream* output = nullptr; //where the program's Output calls print, nowhere when nullptr
+    profile_data profile;
+
+public:
+    vm_interpreter() = default;
+
+    bool load(const std::string& file_name); //adds the functions of one .vm file
+    bool load(std::istream& in, const std::string& file_name); //the same for vm code that isn't in a file, file_name is for messages
+    bool run(long long max_steps); //starts at Sys.init if loaded, otherwise at Main.main
+    profile_data return_profile() const { return profile; }
+    long long return_steps() const { return steps; }
+    void print_to(std::ostream* out) { output = out; }
+
+private:
+    void resolve();
+    short& at(int address);
+    void push(int value);
+    int pop();
+    bool call_builtin(const std::string& name, int num_of_args);
+    int alloc(int size);
+    int new_string(int max_length);
+    void error(std::string what);
+    void print(const std::string& text) { if(output != nullptr) *output << text; }
+};
@@ -1,5 +1,7 @@
 #include "vm_writer.h"
 #include <string>
+#include <sstream>
+#include <algorithm>
 
 
 
@@ -12,6 +14,26 @@ void vm_writer::write_push(segments seg, int num)
 void vm_writer::write_pop(segments seg, int num)
 {
     vm_file.append(std::string("pop ") + segments_string[seg]  +  " " + std::to_string(num) + "\n");
+
+    // the known address in pointer 1 is lost when pointer 1 itself or one of the variables it was computed from is written.
+    // this fields can also be reached through that, and pointer 0 changes what the this parts refer to
+    std::string target = std::string(segments_string[seg]) + " " + std::to_string(num);
+    for(const std::string& part : that_address)
+    {
+        if(part == target || (part.rfind("this ",0) == 0 && (seg == segments::THAT || seg == segments::POINTER)))
+        {
+            that_address.clear();
+            break;
+        }
+    }
+    if(seg == segments::POINTER && num == 1)
+    {
+        that_address.clear();
+    }
+    if(seg == segments::THAT || seg == segments::THIS || seg == segments::STATIC)
+    {
+        side_effects += 1;
+    }
 }
 
 
@@ -35,6 +57,8 @@ void vm_writer::write_arithmetic(command com)
 
 void vm_writer::write_label(std::string label)
 {
+    that_address.clear(); //control can reach a label from somewhere else
+
     vm_file.append(std::string("label ") + label + "\n");
 }
 
@@ -53,15 +77,228 @@ void vm_writer::write_if(std::string label)
 
 void vm_writer::write_call(std::string name, int num)
 {
+    std::string site = current_function + " " + name + " " + std::to_string(call_sites[name]++);
+
+    // that is restored by the return, but the callee can change statics and fields the address was computed from
+    for(const std::string& part : that_address)
+    {
+        if(part.rfind("static ",0) == 0 || part.rfind("this ",0) == 0)
+        {
+            that_address.clear();
+            break;
+        }
+    }
+
+    side_effects += 1;
+    if(inline_sites.find(site) != inline_sites.end())
+    {
+        vm_file.append(std::string("call ") + name + " " + std::to_string(num) + " // inline\n");
+        return;
+    }
     vm_file.append(std::string("call ") + name + " " + std::to_string(num) + "\n");
 }
 
 void vm_writer::write_function(std::string name, int num)
 {
+    that_address.clear();
+    current_function = name;
+    call_sites.clear();
     vm_file.append(std::string("function ") + name + " " + std::to_string(num) + "\n");
 }
 
 void vm_writer::write_return()
 {
+    that_address.clear();
     vm_file.append(std::string("return") + "\n");
 }
+
+void vm_writer::write_code(const std::string& code)
+{
+    if(code.find("pop pointer 1") != std::string::npos)
+    {
+        that_address.clear();
+    }
+    vm_file.append(code);
+}
+
+void vm_writer::write_relabelled(const std::string& code, int label_offset) //appends another writer's functions, its L<n>_ labels become L<n + label_offset>_
+{
+    std::istringstream in(code);
+    std::string line;
+    while(std::getline(in, line))
+    {
+        size_t space = line.find(' ');
+        std::string op = line.substr(0, space);
+        if(label_offset != 0 && (op == "label" || op == "goto" || op == "if-goto") && line.compare(space + 1, 1, "L") == 0)
+        {
+            size_t digits = space + 2;
+            size_t underscore = line.find('_', digits);
+            int n = std::stoi(line.substr(digits, underscore - digits));
+            line = op + " L" + std::to_string(n + label_offset) + line.substr(underscore);
+        }
+        vm_file.append(line + "\n");
+    }
+    that_address.clear();
+}
+
+void vm_writer::rewrite_function(size_t pos, std::string name, int num) //changes the local count of a function line written at pos
+{
+    size_t end = vm_file.find('\n', pos);
+    vm_file.replace(pos, end - pos + 1, std::string("function ") + name + " " + std::to_string(num) + "\n");
+}
+
+void vm_writer::restore(const vm_writer_state& state)
+{
+    vm_file.resize(state.size);
+    cold_code.resize(state.cold_size);
+    that_address = state.that_address;
+    side_effects = state.side_effects;
+    call_sites = state.call_sites;
+}
+
+void vm_writer::move_to_cold(size_t pos)
+{
+    cold_code.append(vm_file.substr(pos));
+    vm_file.resize(pos);
+}
+
+void vm_writer::write_cold_code()
+{
+    vm_file.append(cold_code);
+    cold_code = "";
+}
+
+// Replaces every call written with the inline marker by the callee's own code when the callee is in this file.
+// Arguments and locals of the callee move to locals after the caller's, labels get a per copy suffix and return
+// jumps to the end of the copy with the value left on the stack. pointer 0 and 1 are saved around copies that
+// change them, since a real call would restore them
+void vm_writer::inline_marked_calls()
+{
+    struct vm_function
+    {
+        std::string name;
+        int locals = 0;
+        std::vector<std::string> lines;
+    };
+    std::vector<vm_function> functions;
+    std::unordered_map<std::string,int> function_of;
+    std::istringstream in(vm_file);
+    std::string line;
+    while(std::getline(in, line))
+    {
+        if(line.rfind("function ",0) == 0)
+        {
+            std::istringstream fields(line);
+            vm_function f;
+            std::string keyword;
+            fields >> keyword >> f.name >> f.locals;
+            function_of[f.name] = functions.size();
+            functions.push_back(f);
+        }
+        else if(!functions.empty())
+        {
+            functions.back().lines.push_back(line);
+        }
+    }
+
+    const std::string marker = " // inline";
+    std::string result;
+    for(const vm_function& caller : functions)
+    {
+        int extra_locals = 0;
+        int copies = 0;
+        std::string body;
+        for(const std::string& caller_line : caller.lines)
+        {
+            if(caller_line.size() < marker.size() || caller_line.compare(caller_line.size() - marker.size(), marker.size(), marker) != 0)
+            {
+                body.append(caller_line + "\n");
+                continue;
+            }
+            std::string call = caller_line.substr(0, caller_line.size() - marker.size());
+            std::istringstream fields(call);
+            std::string keyword, callee_name;
+            int num_of_args = 0;
+            fields >> keyword >> callee_name >> num_of_args;
+            auto found = function_of.find(callee_name);
+            if(found == function_of.end() || callee_name == caller.name || functions[found->second].lines.size() > 60)
+            {
+                body.append(call + "\n");
+                continue;
+            }
+            const vm_function& callee = functions[found->second];
+            int base = caller.locals;
+            bool saves_this = false, saves_that = false;
+            for(const std::string& callee_line : callee.lines)
+            {
+                saves_this = saves_this || callee_line == "pop pointer 0";
+                saves_that = saves_that || callee_line == "pop pointer 1";
+            }
+            int this_slot = base + num_of_args + callee.locals;
+            int that_slot = this_slot + saves_this;
+            extra_locals = std::max(extra_locals, num_of_args + callee.locals + saves_this + saves_that);
+            std::string suffix = "_inline" + std::to_string(copies++);
+            std::string end_label = callee_name + suffix;
+
+            for(int i = num_of_args - 1; i >= 0; i--)
+            {
+                body.append("pop local " + std::to_string(base + i) + "\n");
+            }
+            for(int i = 0; i < callee.locals; i++) //locals start at 0 like they do for a real call
+            {
+                body.append("push constant 0\npop local " + std::to_string(base + num_of_args + i) + "\n");
+            }
+            if(saves_this)
+            {
+                body.append("push pointer 0\npop local " + std::to_string(this_slot) + "\n");
+            }
+            if(saves_that)
+            {
+                body.append("push pointer 1\npop local " + std::to_string(that_slot) + "\n");
+            }
+            for(std::string callee_line : callee.lines)
+            {
+                if(callee_line.size() >= marker.size() && callee_line.compare(callee_line.size() - marker.size(), marker.size(), marker) == 0)
+                {
+                    callee_line = callee_line.substr(0, callee_line.size() - marker.size());
+                }
+                std::istringstream callee_fields(callee_line);
+                std::string op, arg1;
+                int arg2 = 0;
+                callee_fields >> op >> arg1 >> arg2;
+                if((op == "push" || op == "pop") && arg1 == "argument")
+                {
+                    body.append(op + " local " + std::to_string(base + arg2) + "\n");
+                }
+                else if((op == "push" || op == "pop") && arg1 == "local")
+                {
+                    body.append(op + " local " + std::to_string(base + num_of_args + arg2) + "\n");
+                }
+                else if(op == "label" || op == "goto" || op == "if-goto")
+                {
+                    body.append(op + " " + arg1 + suffix + "\n");
+                }
+                else if(op == "return")
+                {
+                    body.append("goto " + end_label + "\n");
+                }
+                else
+                {
+                    body.append(callee_line + "\n");
+                }
+            }
+            body.append("label " + end_label + "\n");
+            if(saves_this)
+            {
+                body.append("push local " + std::to_string(this_slot) + "\npop pointer 0\n");
+            }
+            if(saves_that)
+            {
+                body.append("push local " + std::to_string(that_slot) + "\npop pointer 1\n");
+            }
+        }
+        result.append("function " + caller.name + " " + std::to_string(caller.locals + extra_locals) + "\n");
+        result.append(body);
+    }
+    vm_file = result;
+}
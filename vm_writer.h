@@ -1,6 +1,9 @@
 #pragma once
 #include <iostream>
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 
 
 enum segments
@@ -18,13 +21,49 @@ enum command
 inline const char* command_string[] {"add","sub","neg","eq","gt","lt","and","or","not","MUL","DIV"};
 
 
+struct vm_writer_state //everything save() needs to bring the writer back to an earlier point
+{
+    size_t size;
+    size_t cold_size;
+    std::vector<std::string> that_address;
+    int side_effects;
+    std::unordered_map<std::string,int> call_sites;
+};
+
 class vm_writer
 {
     std::string vm_file;
+    std::vector<std::string> that_address; //"segment index" parts whose sum pointer 1 is known to hold, empty when unknown
+    int side_effects = 0; //number of calls and memory stores written so far
+    std::string current_function;
+    std::unordered_map<std::string,int> call_sites; //calls to each subroutine written so far in the current function
+    std::unordered_set<std::string> inline_sites; //"caller callee n" keys of the calls inline_marked_calls expands
+    std::string cold_code; //rarely run blocks, written after the current function's code
 public:
     vm_writer() = default;
 
     std::string return_vm_file() { return vm_file; }
+    std::string take_code() { std::string code; code.swap(vm_file); return code; } //empties the writer, marks taken before are no longer valid
+
+    size_t mark() const { return vm_file.size(); } //position that rollback can later return to
+    void rollback(size_t pos) { vm_file.resize(pos); } //drops everything written after the mark, only used on push/arithmetic code
+
+    void set_that_address(std::vector<std::string> parts) { that_address = parts; } //called right after pop pointer 1 of a known address
+    bool that_address_is(const std::vector<std::string>& parts) const { return !that_address.empty() && that_address == parts; }
+    std::vector<std::string> return_that_address() const { return that_address; }
+
+    std::string text_from(size_t pos) const { return vm_file.substr(pos); } //code written after a mark
+    int return_side_effects() const { return side_effects; }
+
+    vm_writer_state save() const { return vm_writer_state{vm_file.size(), cold_code.size(), that_address, side_effects, call_sites}; }
+    void restore(const vm_writer_state& state);
+    std::string code_since(const vm_writer_state& state) const { return vm_file.substr(state.size) + cold_code.substr(state.cold_size); }
+
+    void move_to_cold(size_t pos); //moves the code written after pos out of the way
+    void write_cold_code(); //places the moved code, called at the end of every function
+
+    void set_inline_sites(std::unordered_set<std::string> sites) { inline_sites = sites; }
+    void inline_marked_calls();
 
 
     void write_pop(segments,int);
@@ -36,5 +75,8 @@ public:
     void write_call(std::string,int);
     void write_function(std::string,int);
     void write_return();
+    void write_code(const std::string& code); //already formatted vm lines
+    void write_relabelled(const std::string& code, int label_offset);
+    void rewrite_function(size_t pos, std::string name, int num);
 
 };
\ No newline at end of file